@@ -4,6 +4,7 @@
 #include <random>
 #include <iostream>
 #include <time.h>
+#include <cstring>
 using namespace std;
 
 const int WIN_W = 800;
@@ -14,6 +15,7 @@ const int NUM_POINTS = 50;
 struct Agent {
     float x, y;
     float angle;
+    float dx, dy; // unit heading, used instead of angle when fast_trig is on
 };
 
 struct Point {
@@ -42,6 +44,13 @@ float deposit_amount = 2.0f;
 float evaporation = 0.05f;
 float diffusion_rate = 0.1f;
 
+// step kernel configuration, see Kernel traits
+const int MAX_SENSORS = 15;
+int num_sensors = 3;    // odd, --sensors n
+bool torus = false;     // --torus
+bool fast_rng = false;  // --fast-rng
+bool hasWalls = false;  // set by the first wall drawn
+
 // mouse drawing
 bool drawing = false; // left button
 int brush_size = 1;   // brush radius
@@ -55,6 +64,8 @@ void initAgents(){
         agents[i].x = randomINT();
         agents[i].y = randomINT();
         agents[i].angle = uni01(rng)*2*M_PI;
+        agents[i].dx = cosf(agents[i].angle);
+        agents[i].dy = sinf(agents[i].angle);
     }
     trail.assign(GRID_W*GRID_H,0.0f);
 }
@@ -68,20 +79,30 @@ void assignPoints(){
 }
 
 // ---- Mouse callbacks ----
+void pickKernels();
+
+void paintWalls(int gx,int gy){
+    for(int dy=-brush_size; dy<=brush_size; dy++){
+        for(int dx=-brush_size; dx<=brush_size; dx++){
+            int gx2 = gx + dx;
+            int gy2 = gy + dy;
+            if(gx2>=0 && gx2<GRID_W && gy2>=0 && gy2<GRID_H){
+                maze[midx(gx2,gy2)] = 1;
+            }
+        }
+    }
+    if(!hasWalls){ // the wall-free kernels no longer apply
+        hasWalls = true;
+        pickKernels();
+    }
+}
+
 void mouse(int button, int state, int x, int y){
     if(button == GLUT_LEFT_BUTTON){
         drawing = (state == GLUT_DOWN);
         int gx = x * GRID_W / WIN_W;
         int gy = (WIN_H - y) * GRID_H / WIN_H;
-        for(int dy=-brush_size; dy<=brush_size; dy++){
-            for(int dx=-brush_size; dx<=brush_size; dx++){
-                int gx2 = gx + dx;
-                int gy2 = gy + dy;
-                if(gx2>=0 && gx2<GRID_W && gy2>=0 && gy2<GRID_H){
-                    maze[midx(gx2,gy2)] = 1;
-                }
-            }
-        }
+        paintWalls(gx,gy);
     }
 }
 
@@ -89,112 +110,315 @@ void motion(int x,int y){
     if(drawing){
         int gx = x * GRID_W / WIN_W;
         int gy = (WIN_H - y) * GRID_H / WIN_H;
-        for(int dy=-brush_size; dy<=brush_size; dy++){
-            for(int dx=-brush_size; dx<=brush_size; dx++){
-                int gx2 = gx + dx;
-                int gy2 = gy + dy;
-                if(gx2>=0 && gx2<GRID_W && gy2>=0 && gy2<GRID_H){
-                    maze[midx(gx2,gy2)] = 1;
-                }
-            }
-        }
+        paintWalls(gx,gy);
+    }
+}
+
+// ---- Fast trigonometry ----
+// With fast_trig on ('t' toggles, or start with --fast-trig) agents steer a
+// unit heading vector: sensor offsets and fixed turns are rotations by
+// constants computed once per step, random turns use fastSinCos(). It is
+// within 2e-7 of sinf/cosf for |a| < 4; the heading is renormalised every
+// step, see adrp.cpp for the drift measurements.
+bool fast_trig = false;
+
+inline void fastSinCos(float a,float &s,float &c){
+    float q = nearbyintf(a*0.63661977f);             // nearest quarter turn
+    float r = a - q*1.57079637f - q*(-4.37113883e-8f);
+    float r2 = r*r;
+    float sr = r + r*r2*(-1.66666667e-1f + r2*(8.33333333e-3f
+             + r2*(-1.98412698e-4f + r2*2.75573192e-6f)));
+    float cr = 1.0f + r2*(-0.5f + r2*(4.16666667e-2f
+             + r2*(-1.38888889e-3f + r2*2.48015873e-5f)));
+    switch((int)q & 3){
+        case 0:  s= sr; c= cr; break;
+        case 1:  s= cr; c=-sr; break;
+        case 2:  s=-sr; c=-cr; break;
+        default: s=-cr; c= sr; break;
+    }
+}
+
+inline void rotate(float &dx,float &dy,float c,float s){
+    float t=dx*c-dy*s;
+    dy=dx*s+dy*c;
+    dx=t;
+}
+
+void setFastTrig(bool on){
+    if(on==fast_trig) return;
+    for(auto &a:agents){
+        if(on){ a.dx=cosf(a.angle); a.dy=sinf(a.angle); }
+        else a.angle=atan2f(a.dy,a.dx);
+    }
+    fast_trig = on;
+    pickKernels();
+}
+
+// ---- Kernel traits ----
+// The step kernels are templates on the run's configuration, so each
+// combination compiles to its own loop with no per-cell tests of settings
+// that cannot change inside a step:
+//   Walls   false while the maze is empty (until the first wall is drawn):
+//           sensing, moving, depositing and diffusion never load maze
+//   Torus   edges wrap around (--torus) instead of bounding the grid
+//   Sensors 3 = forward/left/right, 0 = num_sensors (--sensors n) fanned
+//           evenly over [-sensor_angle, sensor_angle]
+//   Rng     MtRng (the shared mt19937) or XorRng (--fast-rng, xorshift32
+//           kept in a register for the whole step)
+// pickKernels() chooses the instantiation at start and again only when
+// the configuration changes (first wall drawn, 't').
+struct MtRng {
+    float operator()(){ return uni01(rng); }
+};
+
+uint32_t xs_state = (uint32_t)time(0)|1;
+
+struct XorRng {
+    uint32_t s = xs_state;
+    ~XorRng(){ xs_state = s; }
+    float operator()(){
+        s^=s<<13; s^=s>>17; s^=s<<5;
+        return (s>>8)*(1.0f/16777216.0f);
+    }
+};
+
+// cell index of (x,y), false if it is off a bounded grid; a torus wraps
+// once, which is enough since sensor_distance is below the grid size
+template<bool Torus>
+inline bool cellOf(float x,float y,int &i){
+    int xi, yi;
+    if(Torus){
+        xi=(int)floorf(x); yi=(int)floorf(y);
+        if(xi<0) xi+=GRID_W; else if(xi>=GRID_W) xi-=GRID_W;
+        if(yi<0) yi+=GRID_H; else if(yi>=GRID_H) yi-=GRID_H;
+    } else {
+        xi=(int)x; yi=(int)y;
+        if(xi<0 || xi>=GRID_W || yi<0 || yi>=GRID_H) return false;
     }
+    i=idx(xi,yi);
+    return true;
 }
 
 // ---- Trail sampling ----
-float sampleTrailMaze(float x,float y){
-    int xi=(int)x, yi=(int)y;
-    if(xi<0 || xi>=GRID_W || yi<0 || yi>=GRID_H) return 0;
-    if(maze[midx(xi,yi)]==1) return 0; // wall blocks sensing
-    return trail[idx(xi,yi)];
+template<bool Walls,bool Torus>
+inline float sampleTrail(float x,float y){
+    int i;
+    if(!cellOf<Torus>(x,y,i)) return 0;
+    if(Walls && maze[i]==1) return 0; // wall blocks sensing
+    return trail[i];
 }
 
 // ---- Deposit ----
-void deposit(float x,float y,float amount = deposit_amount){
-    int xi=(int)x; int yi=(int)y;
-    if(xi<0||xi>=GRID_W||yi<0||yi>=GRID_H) return;
-    if(maze[midx(xi,yi)]==0) trail[idx(xi,yi)] += amount;
+template<bool Walls,bool Torus>
+inline void deposit(float x,float y,float amount = deposit_amount){
+    int i;
+    if(!cellOf<Torus>(x,y,i)) return;
+    if(!Walls || maze[i]==0) trail[i] += amount;
+}
+
+// move to (nx,ny) unless that is off a bounded grid or a wall
+template<bool Walls,bool Torus>
+inline bool moveTo(Agent &a,float nx,float ny){
+    if(Torus){
+        if(nx<0) nx+=GRID_W;
+        if(nx>=GRID_W) nx-=GRID_W;
+        if(ny<0) ny+=GRID_H;
+        if(ny>=GRID_H) ny-=GRID_H;
+    } else if(!(nx>=0 && nx<GRID_W && ny>=0 && ny<GRID_H)) return false;
+    if(Walls && maze[midx((int)nx,(int)ny)]!=0) return false;
+    a.x = nx;
+    a.y = ny;
+    return true;
+}
+
+// sensor offsets from the heading, right to left
+inline void sensorOffsets(int n,float *off){
+    int h=n/2;
+    for(int k=0;k<n;k++) off[k]=sensor_angle*(k-h)/h;
+}
+
+// +1 turn left, -1 turn right, 0 go straight, 2 random turn; with three
+// sensors the forward/left/right rule, otherwise the best reading on each
+// side stands for that side
+inline int steer(const float *v,int n){
+    int h=n/2;
+    float f=v[h], l=v[h+1], r=v[h-1];
+    for(int k=h+2;k<n;k++) l=max(l,v[k]);
+    for(int k=0;k<h-1;k++) r=max(r,v[k]);
+    if(f>l && f>r) return 0;
+    if(l>r) return 1;
+    if(r>l) return -1;
+    return 2;
 }
 
 // ---- Agent update ----
+template<bool Walls,bool Torus,int Sensors,class Rng>
 void updateAgents(){
+    const int n = Sensors ? Sensors : num_sensors;
+    float off[MAX_SENSORS], v[MAX_SENSORS];
+    sensorOffsets(n,off);
+    Rng rnd;
     for(auto &a:agents){
-        float ax=a.x+cos(a.angle)*sensor_distance;
-        float ay=a.y+sin(a.angle)*sensor_distance;
-        float lx=a.x+cos(a.angle+sensor_angle)*sensor_distance;
-        float ly=a.y+sin(a.angle+sensor_angle)*sensor_distance;
-        float rx=a.x+cos(a.angle-sensor_angle)*sensor_distance;
-        float ry=a.y+sin(a.angle-sensor_angle)*sensor_distance;
-
-        float sF=sampleTrailMaze(ax,ay);
-        float sL=sampleTrailMaze(lx,ly);
-        float sR=sampleTrailMaze(rx,ry);
-
-        if(sF>sL && sF>sR){
-            // go straight
-        } else if(sL>sR){
-            a.angle+=turn_angle;
-        } else if(sR>sL){
-            a.angle-=turn_angle;
-        } else {
-            a.angle+=(uni01(rng)-0.5f)*0.2f;
+        for(int k=0;k<n;k++)
+            v[k]=sampleTrail<Walls,Torus>(a.x+cosf(a.angle+off[k])*sensor_distance,
+                                          a.y+sinf(a.angle+off[k])*sensor_distance);
+
+        switch(steer(v,n)){
+            case 0: break;                      // go straight
+            case 1: a.angle+=turn_angle; break;
+            case -1: a.angle-=turn_angle; break;
+            default: a.angle+=(rnd()-0.5f)*0.2f;
         }
 
-        a.angle += (uni01(rng)-0.5f)*0.5f; // exploration
-
-        // proposed next position
-        float nx = a.x + cosf(a.angle)*step_size;
-        float ny = a.y + sinf(a.angle)*step_size;
+        a.angle += (rnd()-0.5f)*0.5f; // exploration
 
         // move if no wall
-        if(nx>=0 && nx<GRID_W && ny>=0 && ny<GRID_H && maze[midx((int)nx,(int)ny)]==0){
-            a.x = nx;
-            a.y = ny;
-        } else {
-            a.angle += (uni01(rng)-0.5f)*M_PI; // bounce
-        }
+        if(!moveTo<Walls,Torus>(a, a.x+cosf(a.angle)*step_size, a.y+sinf(a.angle)*step_size))
+            a.angle += (rnd()-0.5f)*M_PI; // bounce
 
-        deposit(a.x,a.y);
+        deposit<Walls,Torus>(a.x,a.y);
     }
 
     // reinforce points
     for(auto itr: points){
-        deposit(itr.x,itr.y,100.0f);
+        deposit<Walls,Torus>(itr.x,itr.y,100.0f);
+    }
+}
+
+// ---- Agent update (heading vector) ----
+template<bool Walls,bool Torus,int Sensors,class Rng>
+void updateAgentsFast(){
+    const int n = Sensors ? Sensors : num_sensors;
+    float off[MAX_SENSORS], v[MAX_SENSORS], cs[MAX_SENSORS], ss[MAX_SENSORS];
+    sensorOffsets(n,off);
+    for(int k=0;k<n;k++){ cs[k]=cosf(off[k]); ss[k]=sinf(off[k]); }
+    float ct=cosf(turn_angle), st=sinf(turn_angle);
+    Rng rnd;
+    for(auto &a:agents){
+        float dx=a.dx, dy=a.dy;
+        for(int k=0;k<n;k++)
+            v[k]=sampleTrail<Walls,Torus>(a.x+(dx*cs[k]-dy*ss[k])*sensor_distance,
+                                          a.y+(dx*ss[k]+dy*cs[k])*sensor_distance);
+
+        float turn=0, s, c;
+        switch(steer(v,n)){
+            case 0: break;                      // go straight
+            case 1: rotate(dx,dy,ct,st); break;
+            case -1: rotate(dx,dy,ct,-st); break;
+            default: turn+=(rnd()-0.5f)*0.2f;
+        }
+
+        turn += (rnd()-0.5f)*0.5f; // exploration
+        fastSinCos(turn,s,c);
+        rotate(dx,dy,c,s);
+
+        // one Newton step keeps the heading at unit length
+        float k=1.5f-0.5f*(dx*dx+dy*dy);
+        dx*=k; dy*=k;
+
+        if(!moveTo<Walls,Torus>(a, a.x+dx*step_size, a.y+dy*step_size)){
+            fastSinCos((rnd()-0.5f)*(float)M_PI,s,c); // bounce
+            rotate(dx,dy,c,s);
+        }
+        a.dx=dx; a.dy=dy;
+
+        deposit<Walls,Torus>(a.x,a.y);
+    }
+
+    for(auto itr: points){
+        deposit<Walls,Torus>(itr.x,itr.y,100.0f);
     }
 }
 
 // ---- Diffusion & Evaporation ----
+vector<float> trailTmp; // diffusion target, swapped with trail
+
+// new value of cell x of row c, given its left and right neighbour columns
+// and the rows above and below
+template<bool Walls>
+inline void diffuseCell(int x,int xm,int xp,const float *tu,const float *tc,const float *td,
+                        const int *mu,const int *mc,const int *md,float *out){
+    if(Walls && mc[x]==1){ out[x] = tc[x]; return; } // walls keep their value
+    const int xs[3] = {xm,x,xp};
+    float sum = 0.0f;
+    int count = 0;
+    for(int i=0; i<3; i++){ if(!Walls || mu[xs[i]]==0){ sum += tu[xs[i]]; count++; } }
+    for(int i=0; i<3; i++){ if(!Walls || mc[xs[i]]==0){ sum += tc[xs[i]]; count++; } }
+    for(int i=0; i<3; i++){ if(!Walls || md[xs[i]]==0){ sum += td[xs[i]]; count++; } }
+    if(count>0) out[x] = tc[x]*(1-diffusion_rate) + (sum/count)*diffusion_rate;
+}
+
+// A bounded grid leaves its border cells as they are; on a torus every
+// cell diffuses with its wrapped neighbours.
+template<bool Walls,bool Torus>
 void diffuse(){
-    vector<float> newTrail = trail;
-
-    for(int y=1; y<GRID_H-1; y++){
-        for(int x=1; x<GRID_W-1; x++){
-            if(maze[idx(x,y)]==1) continue; // skip walls
-            float sum = 0.0f;
-            int count = 0;
-            for(int dy=-1; dy<=1; dy++){
-                for(int dx=-1; dx<=1; dx++){
-                    int nx = x+dx;
-                    int ny = y+dy;
-                    if(maze[idx(nx,ny)]==0){
-                        sum += trail[idx(nx,ny)];
-                        count++;
-                    }
-                }
-            }
-            if(count>0) newTrail[idx(x,y)] = trail[idx(x,y)]*(1-diffusion_rate) + (sum/count)*diffusion_rate;
+    trailTmp.resize(trail.size());
+    const int b = Torus ? 0 : 1;
+    if(!Torus){ // the border keeps its value; every other cell is rewritten
+        copy(&trail[idx(0,0)],&trail[idx(0,1)],&trailTmp[idx(0,0)]);
+        copy(&trail[idx(0,GRID_H-1)],&trail[idx(0,GRID_H-1)]+GRID_W,&trailTmp[idx(0,GRID_H-1)]);
+        for(int y=1; y<GRID_H-1; y++){
+            trailTmp[idx(0,y)] = trail[idx(0,y)];
+            trailTmp[idx(GRID_W-1,y)] = trail[idx(GRID_W-1,y)];
         }
     }
 
-    trail = newTrail;
+    for(int y=b; y<GRID_H-b; y++){
+        int ym = (Torus && y==0) ? GRID_H-1 : y-1;
+        int yp = (Torus && y==GRID_H-1) ? 0 : y+1;
+        const float *tu=&trail[idx(0,ym)], *tc=&trail[idx(0,y)], *td=&trail[idx(0,yp)];
+        const int *mu=&maze[midx(0,ym)], *mc=&maze[midx(0,y)], *md=&maze[midx(0,yp)];
+        float *out=&trailTmp[idx(0,y)];
+        for(int x=1; x<GRID_W-1; x++)
+            diffuseCell<Walls>(x,x-1,x+1,tu,tc,td,mu,mc,md,out);
+        if(Torus){
+            diffuseCell<Walls>(0,GRID_W-1,1,tu,tc,td,mu,mc,md,out);
+            diffuseCell<Walls>(GRID_W-1,GRID_W-2,0,tu,tc,td,mu,mc,md,out);
+        }
+    }
+
+    trail.swap(trailTmp);
 }
 
+template<bool Walls>
 void evaporate(){
-    for(int y=0;y<GRID_H;y++){
-        for(int x=0;x<GRID_W;x++){
-            if(maze[idx(x,y)]==0)
-                trail[idx(x,y)] *= (1.0f-evaporation);
-        }
+    for(size_t i=0;i<trail.size();i++){
+        if(!Walls || maze[i]==0)
+            trail[i] *= (1.0f-evaporation);
+    }
+}
+
+// ---- Kernel dispatch ----
+void (*updateKernel)() = nullptr;
+void (*diffuseKernel)() = nullptr;
+void (*evaporateKernel)() = nullptr;
+
+template<bool Walls,bool Torus,int Sensors,class Rng>
+void pickWith(){
+    updateKernel = fast_trig ? updateAgentsFast<Walls,Torus,Sensors,Rng>
+                             : updateAgents<Walls,Torus,Sensors,Rng>;
+    diffuseKernel = diffuse<Walls,Torus>;
+    evaporateKernel = evaporate<Walls>;
+}
+
+template<bool Walls,bool Torus>
+void pickSensors(){
+    if(num_sensors==3){
+        if(fast_rng) pickWith<Walls,Torus,3,XorRng>();
+        else pickWith<Walls,Torus,3,MtRng>();
+    } else {
+        if(fast_rng) pickWith<Walls,Torus,0,XorRng>();
+        else pickWith<Walls,Torus,0,MtRng>();
+    }
+}
+
+void pickKernels(){
+    if(hasWalls){
+        if(torus) pickSensors<true,true>();
+        else pickSensors<true,false>();
+    } else {
+        if(torus) pickSensors<false,true>();
+        else pickSensors<false,false>();
     }
 }
 
@@ -202,9 +426,9 @@ void evaporate(){
 void display(){
     glClear(GL_COLOR_BUFFER_BIT);
 
-    updateAgents();
-    diffuse();
-    evaporate();
+    updateKernel();
+    diffuseKernel();
+    evaporateKernel();
 
     glBegin(GL_POINTS);
 
@@ -242,6 +466,14 @@ void display(){
     glutPostRedisplay();
 }
 
+// ---- Keyboard ----
+void keyboard(unsigned char key,int x,int y){
+    if(key=='t'){
+        setFastTrig(!fast_trig);
+        cout<<(fast_trig ? "fast trig on" : "fast trig off")<<endl;
+    }
+}
+
 // ---- Main ----
 int main(int argc,char**argv){
     srand(time(0));
@@ -255,9 +487,18 @@ int main(int argc,char**argv){
 
     glutMouseFunc(mouse);
     glutMotionFunc(motion);
+    glutKeyboardFunc(keyboard);
 
     initAgents();
     assignPoints();
+    for(int i=1;i<argc;i++){
+        if(!strcmp(argv[i],"--fast-trig")) setFastTrig(true);
+        else if(!strcmp(argv[i],"--torus")) torus = true;
+        else if(!strcmp(argv[i],"--fast-rng")) fast_rng = true;
+        else if(!strcmp(argv[i],"--sensors") && i+1<argc)
+            num_sensors = min(MAX_SENSORS,max(3,atoi(argv[++i])))|1;
+    }
+    pickKernels();
     glutDisplayFunc(display);
     glutMainLoop();
     return 0;
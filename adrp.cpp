@@ -1,4 +1,6 @@
+#ifndef ADRP_LIB
 #include <glut.h>
+#endif
 #include <vector>
 #include <cmath>
 #include <random>
@@ -7,9 +9,38 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cfloat>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <queue>
+#ifndef _WIN32
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
+#ifndef ADRP_LIB
 static int cnt = 0;
 static auto last = std::chrono::high_resolution_clock::now();
+#endif
 using namespace std;
 
 const int WIN_W = 800;
@@ -22,43 +53,223 @@ int count=0;
 struct Agent {
     float x, y;
     float angle;
+    float dx, dy; // unit heading, used instead of angle when fast_trig is on
+    uint32_t id;  // index at creation, orders deposits in --sync runs
 };
 
 struct Point {
     float x,y;
+    float weight; // demand multiplier for the food deposit
+    int id;       // stable id used by the event API / scripts
 };
 
-vector<Agent> agents;
+// ---------- Allocation ----------
+// The big simulation arrays (trail layers, maze, agents) use SimAlloc.
+// Blocks of HUGE_PAGE bytes or more are mapped directly, 2MB aligned; with
+// --alloc huge they are advised onto transparent huge pages, so the random
+// sensor reads of a large grid take far fewer TLB misses, and --alloc
+// small keeps them on 4KB pages for comparison. Pages are first touched by
+// the loop that fills them: under --workers that is the worker owning the
+// strip, and --numa pins each worker to one NUMA node so its strip, halo
+// and agents are allocated there. Smaller blocks use operator new.
+enum AllocMode { ALLOC_DEFAULT, ALLOC_HUGE, ALLOC_SMALL };
+AllocMode allocMode = ALLOC_DEFAULT;
+const size_t HUGE_PAGE = 2<<20;
+
+#ifndef _WIN32
+inline size_t hugeRound(size_t bytes){ return (bytes+HUGE_PAGE-1)/HUGE_PAGE*HUGE_PAGE; }
+
+void* mapBlock(size_t bytes){
+    size_t len = hugeRound(bytes);
+    char* p = (char*)mmap(nullptr,len+HUGE_PAGE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if(p==MAP_FAILED) throw bad_alloc();
+    char* a = (char*)(((uintptr_t)p+HUGE_PAGE-1)&~(uintptr_t)(HUGE_PAGE-1));
+    if(a>p) munmap(p,a-p);
+    munmap(a+len,p+len+HUGE_PAGE-(a+len));
+    if(allocMode==ALLOC_HUGE) madvise(a,len,MADV_HUGEPAGE);
+    if(allocMode==ALLOC_SMALL) madvise(a,len,MADV_NOHUGEPAGE);
+    return a;
+}
+
+template<class T> struct SimAlloc {
+    typedef T value_type;
+    SimAlloc(){}
+    template<class U> SimAlloc(const SimAlloc<U>&){}
+    T* allocate(size_t n){
+        size_t bytes = n*sizeof(T);
+        return (T*)(bytes>=HUGE_PAGE ? mapBlock(bytes) : ::operator new(bytes));
+    }
+    void deallocate(T* p,size_t n){
+        size_t bytes = n*sizeof(T);
+        if(bytes>=HUGE_PAGE) munmap(p,hugeRound(bytes));
+        else ::operator delete(p);
+    }
+    template<class U> bool operator==(const SimAlloc<U>&) const { return true; }
+    template<class U> bool operator!=(const SimAlloc<U>&) const { return false; }
+};
+
+// memory of this process backed by huge pages
+long hugePagesKB(){
+    ifstream in("/proc/self/smaps_rollup");
+    string key;
+    long kb;
+    while(in>>key){
+        if(key=="AnonHugePages:" && in>>kb) return kb;
+        in.ignore(1<<20,'\n');
+    }
+    return 0;
+}
+#else
+template<class T> using SimAlloc = std::allocator<T>;
+inline long hugePagesKB(){ return 0; }
+#endif
+
+typedef vector<Agent,SimAlloc<Agent>> AgentVec;
+
+AgentVec agents;
 vector<Point> points(NUM_POINTS);
-vector<float> trail;
+// ---------- Trail storage ----------
+// The trail is float by default. Building with -DTRAIL_FIXED16 stores it as
+// uint16 fixed point instead (TRAIL_SCALE steps per unit, deposits saturate
+// at 65535/TRAIL_SCALE), halving the bytes the field sweeps stream. All
+// access goes through these helpers; tsum_t is the type neighbour sums are
+// accumulated in.
+#ifdef TRAIL_FIXED16
+#ifndef TRAIL_SCALE
+#define TRAIL_SCALE 16
+#endif
+typedef uint16_t trail_t;
+typedef int tsum_t;
+inline float tload(trail_t v){ return v*(1.0f/TRAIL_SCALE); }
+inline float tsum(tsum_t s){ return s*(1.0f/TRAIL_SCALE); }
+inline trail_t tstore(float v){
+    return (trail_t)(int)min(max(v*TRAIL_SCALE+0.5f,0.0f),65535.0f);
+}
+// decay in integer steps, rounding down so small values still reach zero
+inline trail_t tscale(trail_t v,float k){
+    return (trail_t)((v*(uint32_t)(k*65536.0f))>>16);
+}
+inline void tadd(trail_t &v,float amt){
+    int s = v + (int)(amt*TRAIL_SCALE + 0.5f);
+    v = s>65535 ? 65535 : s;
+}
+#else
+typedef float trail_t;
+typedef float tsum_t;
+inline float tload(trail_t v){ return v; }
+inline float tsum(tsum_t s){ return s; }
+inline trail_t tstore(float v){ return v; }
+inline trail_t tscale(trail_t v,float k){ return v*k; }
+inline void tadd(trail_t &v,float amt){ v += amt; }
+#endif
+
+// ---------- Cell storage ----------
+// A grid layer: cells of its own, or a window into a memory-mapped grid
+// file (see Grid files). Indexing, iteration and swap work the same.
+template<class T> struct Cells {
+    vector<T,SimAlloc<T>> own;
+    T* p = nullptr;
+    size_t n = 0;
+
+    T& operator[](size_t i){ return p[i]; }
+    const T& operator[](size_t i) const { return p[i]; }
+    T* begin(){ return p; }
+    T* end(){ return p+n; }
+    size_t size() const { return n; }
+    bool empty() const { return n==0; }
+    void assign(size_t count,T v){ own.assign(count,v); p=own.data(); n=count; }
+    void resize(size_t count){
+        if(count==n) return;
+        own.resize(count); p=own.data(); n=count;
+    }
+    void view(T* at,size_t count){ decltype(own)().swap(own); p=at; n=count; }
+    // keep only cells [from,to)
+    void keep(size_t from,size_t to){
+        decltype(own) v(p+from,p+to);
+        own.swap(v); p=own.data(); n=to-from;
+    }
+    void swap(Cells &o){ own.swap(o.own); std::swap(p,o.p); std::swap(n,o.n); }
+};
+
+Cells<trail_t> trail;
+Cells<trail_t> trailTmp;  // diffusion target, swapped with trail
 
 int GRID_W , GRID_H;
+// maze and trail hold rows [ROW0,ROW1): the whole grid, except in a
+// --workers process, which keeps only its strip plus halo rows
+int ROW0 = 0, ROW1 = 0;
+
+// Maze: terrain cost per cell, 0 = free road at full speed, 1..254 = slower
+// roads, WALL = impassable. One byte gives both the wall test and the cost.
+const unsigned char WALL = 255;
+Cells<unsigned char> maze;
+bool openMap = false;   // no walls and one terrain speed, see Agent update
+
+inline size_t idx(int x,int y){ return (size_t)(y-ROW0)*GRID_W + x; }
+
+// Terrain lookup tables indexed by the maze byte; walls map to 0 speed
+float terrain_min_speed = 0.25f;  // speed of the slowest road
+float terrain_deposit_gain = 1.0f; // 0 = deposit ignores terrain
+float terrainSpeed[256];
+float terrainDeposit[256];
+
+void buildTerrainLUT(){
+    for(int c=0;c<256;c++){
+        float s = 1.0f - (1.0f-terrain_min_speed)*c/254.0f;
+        terrainSpeed[c] = (c==WALL) ? 0.0f : s;
+        terrainDeposit[c] = (c==WALL) ? 0.0f : 1.0f - terrain_deposit_gain*(1.0f-s);
+    }
+}
+
+// grey <= 128 is a wall; brighter grey is a road whose cost falls to 0 at
+// white. A separate speed raster (same size, white = fast) can be given
+// instead of deriving the cost from the map itself.
+unsigned char mazeByte(int grey,int costGrey,bool costFromMap,bool useTerrain){
+    if(grey <= 128) return WALL;
+    int c = useTerrain ? 255 - costGrey : 0;
+    if(costFromMap) c = c*254/126;
+    return (unsigned char)min(c,254);
+}
+
+// maze of a decoded w x h map; cost is the map itself or a speed raster
+void buildMaze(const unsigned char* data,const unsigned char* cost,int w,int h,bool useTerrain){
+    GRID_W = w;
+    GRID_H = h;
+    ROW0 = 0; ROW1 = h;
+    maze.assign(GRID_W*GRID_H,WALL);
 
-// Maze: 0 = free, 1 = wall
-vector<int> maze;
+    for(int y=0;y<h;y++)
+        for(int x=0;x<w;x++)
+            maze[idx(x,y)] = mazeByte(data[y*w+x],cost[y*w+x],cost==data,useTerrain);
 
-inline int idx(int x,int y){ return y*GRID_W + x; }
+    openMap = all_of(maze.begin(),maze.end(),[](unsigned char c){ return c==0; });
+    buildTerrainLUT();
+}
 
-void loadMap(const char* filename){
+// false if the map cannot be decoded; the maze is then left as it was
+bool loadMap(const char* filename,const char* terrainFile=nullptr,bool useTerrain=true){
     int w,h,n;
     unsigned char* data = stbi_load(filename,&w,&h,&n,1);
     if(!data){
         cout<<"Failed to load map\n";
-        return;
+        return false;
     }
 
-    GRID_W = w;
-    GRID_H = h;
-    maze.assign(GRID_W*GRID_H,1);
-
-    for(int y=0;y<h;y++){
-        for(int x=0;x<w;x++){
-            int v = data[y*w + x];
-            maze[idx(x,y)] = (v > 128) ? 0 : 1; // white = road
+    unsigned char* cost = data;
+    if(terrainFile){
+        int tw,th;
+        cost = stbi_load(terrainFile,&tw,&th,&n,1);
+        if(!cost || tw!=w || th!=h){
+            cout<<"Terrain map missing or not "<<w<<"x"<<h<<", using map grey levels\n";
+            if(cost) stbi_image_free(cost);
+            cost = data;
         }
     }
 
+    buildMaze(data,cost,w,h,useTerrain);
+    if(cost!=data) stbi_image_free(cost);
     stbi_image_free(data);
+    return true;
 }
 
 mt19937 rng(time(0));
@@ -72,6 +283,8 @@ float step_size = 0.1f;
 float deposit_amount = 2.0f;
 float evaporation = 0.05f;
 float diffusion_rate = 0.1f;
+bool fast_trig = false;   // heading vectors instead of cos/sin, see below
+bool sync_update = false; // order-independent agent update, see below
 
 // Mouse drawing
 bool drawing = false;
@@ -79,24 +292,37 @@ int brush_size = 1;
 
 int randomINT(){ return rand() % GRID_H; }
 
-// ---------- Initialization ----------
-void initAgents(){
-    agents.resize(NUM_AGENTS);
-    trail.assign(GRID_W*GRID_H,0.0f);
+long stepCount = 0;
 
-    for(auto &a : agents){
+// ---------- Initialization ----------
+// place agents [from,to) on random free cells
+void placeAgents(size_t from,size_t to){
+    for(size_t i=from;i<to;i++){
+        Agent &a = agents[i];
         int x,y;
         do{
             x = rand() % GRID_W;
             y = rand() % GRID_H;
-        }while(maze[idx(x,y)]==1);
+        }while(maze[idx(x,y)]==WALL);
 
         a.x = x;
         a.y = y;
         a.angle = uni01(rng)*2*M_PI;
+        a.dx = cosf(a.angle);
+        a.dy = sinf(a.angle);
+        a.id = i;
     }
 }
 
+void initAgents(){
+    agents.reserve(NUM_AGENTS);   // the --adaptive pool
+    agents.resize(NUM_AGENTS);
+    trail.assign(GRID_W*GRID_H,tstore(0.0f));
+    placeAgents(0,agents.size());
+}
+
+
+int nextPointId = 0;
 
 void assignPoints(){
     for(auto &p : points){
@@ -104,180 +330,3580 @@ void assignPoints(){
         do{
             x = rand() % GRID_W;
             y = rand() % GRID_H;
-        }while(maze[idx(x,y)]==1);
+        }while(maze[idx(x,y)]==WALL);
 
         p.x = x;
         p.y = y;
-        trail[idx(x,y)] = 50.0f;
+        p.weight = 1.0f;
+        p.id = nextPointId++;
+        trail[idx(x,y)] = tstore(50.0f);
+    }
+}
+
+// ---------- Warm start ----------
+// --warm-start seeds the run with the routes the network is likely to take
+// instead of letting it find them from a blank trail. A multi-source
+// Dijkstra from the points gives every free cell its travel time to the
+// nearest point (terrain speed included) and which point that is. Where two
+// such regions touch, the cheapest crossing is the shortest route between
+// the two points; walking down the distance field from it on both sides
+// traces that route. The trail gets warm_level on the routes and a
+// potential falling off with the travel time around every point, and
+// warm_agents of the agents start on the routes, heading along them.
+float warm_level = 150.0f;     // trail on the traced routes
+float warm_potential = 50.0f;  // trail at a point, falls off as exp(-d/warm_length)
+float warm_length = 20.0f;
+float warm_agents = 0.5f;      // share of agents placed on the routes
+bool warmStarted = false;      // reported by the convergence check
+
+void warmStart(){
+    const float INF = 1e30f;
+    const int DX[8]={1,-1,0,0,1,1,-1,-1}, DY[8]={0,0,1,-1,1,-1,1,-1};
+    const float LEN[8]={1,1,1,1,(float)M_SQRT2,(float)M_SQRT2,(float)M_SQRT2,(float)M_SQRT2};
+    size_t cells=(size_t)GRID_W*GRID_H;
+    vector<float> dist(cells,INF);
+    vector<int> owner(cells,-1);
+    typedef pair<float,size_t> Item;
+    priority_queue<Item,vector<Item>,greater<Item>> open;
+    for(size_t k=0;k<points.size();k++){
+        size_t i=idx((int)points[k].x,(int)points[k].y);
+        if(maze[i]==WALL || dist[i]==0) continue;
+        dist[i]=0; owner[i]=k;
+        open.push({0.0f,i});
+    }
+    while(!open.empty()){
+        Item it=open.top(); open.pop();
+        size_t i=it.second;
+        if(it.first>dist[i]) continue;
+        int x=i%GRID_W, y=i/GRID_W;
+        for(int d=0;d<8;d++){
+            int nx=x+DX[d], ny=y+DY[d];
+            if(nx<0||nx>=GRID_W||ny<0||ny>=GRID_H) continue;
+            size_t n=idx(nx,ny);
+            if(maze[n]==WALL) continue;
+            float nd=dist[i]+LEN[d]/terrainSpeed[maze[n]];
+            if(nd<dist[n]){ dist[n]=nd; owner[n]=owner[i]; open.push({nd,n}); }
+        }
+    }
+
+    // cheapest crossing between every pair of touching regions
+    struct Crossing{ int a,b; float cost; size_t i,n; };
+    vector<Crossing> cross;
+    for(int y=0;y<GRID_H;y++)
+        for(int x=0;x<GRID_W;x++){
+            size_t i=idx(x,y);
+            if(owner[i]<0) continue;
+            for(int d=0;d<2;d++){   // right and down neighbours
+                int nx=x+DX[d*2], ny=y+DY[d*2];
+                if(nx>=GRID_W||ny>=GRID_H) continue;
+                size_t n=idx(nx,ny);
+                if(owner[n]<0 || owner[n]==owner[i]) continue;
+                Crossing c={min(owner[i],owner[n]),max(owner[i],owner[n]),dist[i]+dist[n],i,n};
+                cross.push_back(c);
+            }
+        }
+    sort(cross.begin(),cross.end(),[](const Crossing &p,const Crossing &q){
+        return p.a!=q.a ? p.a<q.a : p.b!=q.b ? p.b<q.b : p.cost<q.cost;
+    });
+
+    // walk each side of a crossing down to its point
+    vector<unsigned char> route(cells,0);
+    vector<size_t> routeCells;
+    auto trace=[&](size_t i){
+        while(true){
+            if(!route[i]){ route[i]=1; routeCells.push_back(i); }
+            if(dist[i]==0) return;
+            int x=i%GRID_W, y=i/GRID_W;
+            size_t next=i;
+            for(int d=0;d<8;d++){
+                int nx=x+DX[d], ny=y+DY[d];
+                if(nx<0||nx>=GRID_W||ny<0||ny>=GRID_H) continue;
+                size_t n=idx(nx,ny);
+                if(dist[n]<dist[next]) next=n;
+            }
+            if(next==i) return;
+            i=next;
+        }
+    };
+    long routes=0;
+    for(size_t k=0;k<cross.size();k++){
+        if(k>0 && cross[k].a==cross[k-1].a && cross[k].b==cross[k-1].b) continue;
+        trace(cross[k].i);
+        trace(cross[k].n);
+        routes++;
+    }
+
+    for(size_t i=0;i<cells;i++){
+        if(dist[i]==INF) continue;
+        float v=warm_potential*expf(-dist[i]/warm_length);
+        if(route[i]) v=max(v,warm_level);
+        trail[i]=tstore(max(tload(trail[i]),v));
+    }
+
+    // agents on random route cells, heading down or up the distance field
+    size_t n=routeCells.empty() ? 0 : (size_t)(warm_agents*agents.size());
+    for(size_t k=0;k<n;k++){
+        Agent &a=agents[k];
+        size_t i=routeCells[rand()%routeCells.size()];
+        int x=i%GRID_W, y=i/GRID_W;
+        int down=-1;
+        float best=dist[i];
+        for(int d=0;d<8;d++){
+            int nx=x+DX[d], ny=y+DY[d];
+            if(nx<0||nx>=GRID_W||ny<0||ny>=GRID_H) continue;
+            if(dist[idx(nx,ny)]<best){ best=dist[idx(nx,ny)]; down=d; }
+        }
+        a.x=x; a.y=y;
+        a.angle=down<0 ? uni01(rng)*2*M_PI : atan2f(DY[down],DX[down]);
+        if(uni01(rng)<0.5f) a.angle+=M_PI;
+        a.dx=cosf(a.angle);
+        a.dy=sinf(a.angle);
+    }
+    warmStarted=true;
+    cout<<"Warm start: "<<routes<<" routes, "<<routeCells.size()<<" cells, "<<n<<" agents placed\n";
+}
+
+// ---------- Level of detail ----------
+// The renderer draws the pyramid level whose cells best match the window
+// pixels, so big grids never push more than a window's worth of texels.
+// Level l+1 max-pools the trail and averages the wall coverage of 2x2
+// cells of level l; level 0 is the grid itself. updateLod() recomputes only
+// the footprint of dirty tiles: tiles whose walls or points changed, and
+// tiles with visible trail on them or next to them at the last update
+// (trail spreads less than one tile between updates).
+const int LOD_TILE = 64;
+const float LOD_VISIBLE = 0.01f;   // dimmer trail is drawn black
+
+struct LodLevel {
+    int w,h;
+    vector<float> trail;          // max of the cells below
+    vector<unsigned char> wall;   // wall coverage, 255 = all wall
+};
+
+vector<LodLevel> lod;
+int tilesX=0, tilesY=0;
+vector<unsigned char> tileDirty, tileLive;
+
+// mark the tiles touching cells [x0,x1]x[y0,y1] for recomputation
+void markLodDirty(int x0,int y0,int x1,int y1){
+    if(tileDirty.empty()) return;
+    x0=max(x0,0); y0=max(y0,0);
+    x1=min(x1,GRID_W-1); y1=min(y1,GRID_H-1);
+    for(int ty=y0/LOD_TILE;ty<=y1/LOD_TILE;ty++)
+        for(int tx=x0/LOD_TILE;tx<=x1/LOD_TILE;tx++)
+            tileDirty[ty*tilesX+tx]=1;
+}
+
+void initLod(){
+    lod.clear();
+    int w=GRID_W, h=GRID_H;
+    lod.push_back({w,h,{},{}});
+    while(w>1 || h>1){
+        w=(w+1)/2; h=(h+1)/2;
+        lod.push_back({w,h,vector<float>(w*h,0.0f),vector<unsigned char>(w*h,0)});
+    }
+    tilesX=(GRID_W+LOD_TILE-1)/LOD_TILE;
+    tilesY=(GRID_H+LOD_TILE-1)/LOD_TILE;
+    tileDirty.assign(tilesX*tilesY,1);
+    tileLive.assign(tilesX*tilesY,0);
+}
+
+void updateLod(){
+    // live tiles and their neighbours may have changed since the last update
+    vector<unsigned char> todo=tileDirty;
+    for(int ty=0;ty<tilesY;ty++)
+        for(int tx=0;tx<tilesX;tx++){
+            if(!tileLive[ty*tilesX+tx]) continue;
+            for(int ny=max(ty-1,0);ny<=min(ty+1,tilesY-1);ny++)
+                for(int nx=max(tx-1,0);nx<=min(tx+1,tilesX-1);nx++)
+                    todo[ny*tilesX+nx]=1;
+        }
+
+    for(size_t l=1;l<lod.size();l++){
+        LodLevel &lv=lod[l];
+        const LodLevel &src=lod[l-1];
+        for(int ty=0;ty<tilesY;ty++)
+            for(int tx=0;tx<tilesX;tx++){
+                if(!todo[ty*tilesX+tx]) continue;
+                int x0=(tx*LOD_TILE)>>l, x1=min((((tx+1)*LOD_TILE-1)>>l),lv.w-1);
+                int y0=(ty*LOD_TILE)>>l, y1=min((((ty+1)*LOD_TILE-1)>>l),lv.h-1);
+                float tileMax=0;
+                for(int y=y0;y<=y1;y++)
+                    for(int x=x0;x<=x1;x++){
+                        float m=0; int wsum=0, n=0;
+                        for(int cy=2*y;cy<=min(2*y+1,src.h-1);cy++)
+                            for(int cx=2*x;cx<=min(2*x+1,src.w-1);cx++){
+                                int c=cy*src.w+cx;
+                                if(l==1){
+                                    m=max(m,tload(trail[c]));
+                                    wsum+=(maze[c]==WALL)*255;
+                                } else {
+                                    m=max(m,src.trail[c]);
+                                    wsum+=src.wall[c];
+                                }
+                                n++;
+                            }
+                        lv.trail[y*lv.w+x]=m;
+                        lv.wall[y*lv.w+x]=wsum/n;
+                        tileMax=max(tileMax,m);
+                    }
+                if(l==1) tileLive[ty*tilesX+tx]=(tileMax>LOD_VISIBLE);
+            }
+    }
+    fill(tileDirty.begin(),tileDirty.end(),0);
+}
+
+// ---------- Convergence ----------
+// Every conv_interval steps the trail is folded into a moving average and the
+// cells above conv_threshold times its mean are taken as the network; once
+// that set stays within conv_eps for conv_patience snapshots the network
+// counts as converged. After a point event only the cells within
+// conv_radius of the changed points are compared, since a local re-route is
+// too small to show up in the churn of the whole network.
+int conv_interval = 25;
+float conv_threshold = 2.0f;  // times the mean trail of free cells
+float conv_hysteresis = 0.6f; // leave threshold, relative to conv_threshold
+float conv_smooth = 0.3f;     // EMA weight of each snapshot
+float conv_eps = 0.07f;
+int conv_patience = 4;
+int conv_radius = 40;
+
+vector<float> convAvg;           // smoothed trail, filters agent noise
+vector<unsigned char> convMask;
+long anchorSize = 0;     // network cells when the stable run began
+long anchorStep = 0;
+long convStart = 0;      // step of the last restart (0 or last event)
+int convX0=0, convY0=0, convX1=1<<30, convY1=1<<30; // compared region
+long coldSteps = -1;     // steps the cold start needed, kept across events
+bool coldRun = true;     // no event since step 0: the next convergence is the cold start
+bool convergedOnce = false;
+int stableRuns = 0;
+bool converged = false;
+float netThreshold = 0;  // network threshold and size over the whole grid
+long netCells = 0;
+
+// restart convergence tracking around (x,y); the region grows to cover
+// every event that lands before the network settles again. Points placed
+// before the first step are part of the cold start and restart nothing.
+void resetConvergence(float x,float y){
+    if(stepCount==0) return;
+    int r = conv_radius;
+    if(converged || stepCount!=convStart){
+        convX0=convY0=1<<30;
+        convX1=convY1=-1;
+    }
+    convX0 = min(convX0,(int)x-r); convX1 = max(convX1,(int)x+r);
+    convY0 = min(convY0,(int)y-r); convY1 = max(convY1,(int)y+r);
+    convStart = stepCount;
+    stableRuns = 0;
+    converged = false;
+    coldRun = false;
+    // the next snapshot is the first one taken after the trail has reacted,
+    // so the stable run may not begin before it
+    anchorSize = 0;
+}
+
+void checkConvergence(){
+    if(stepCount % conv_interval) return;
+
+    convAvg.resize(trail.size(),0.0f);
+    double sum=0; long freeCells=0;
+    for(size_t i=0;i<trail.size();i++){
+        if(maze[i]==WALL) continue;
+        convAvg[i] += (tload(trail[i])-convAvg[i])*conv_smooth;
+        sum += convAvg[i];
+        freeCells++;
+    }
+    float thr = conv_threshold*sum/max(freeCells,1L);
+
+    long changed=0, total=0, size=0;
+    netThreshold = thr;
+    netCells = 0;
+    convMask.resize(trail.size(),0);
+    for(size_t i=0;i<trail.size();i++){
+        // hysteresis: cells already on the network stay on until they
+        // drop well below the threshold, so edge cells do not flicker
+        float t = convMask[i] ? thr*conv_hysteresis : thr;
+        unsigned char m = (maze[i]!=WALL && convAvg[i]>t);
+        int x=i%GRID_W, y=i/GRID_W;
+        if(x>=convX0 && x<=convX1 && y>=convY0 && y<=convY1){
+            changed += (m!=convMask[i]);
+            total += (m|convMask[i]);
+            size += m;
+        }
+        convMask[i] = m;
+        netCells += m;
+    }
+
+    // agents keep the network edges moving, so besides a low churn between
+    // snapshots the network size must hold within conv_eps of its value at
+    // the start of the stable run; a slow growth or decay adds up there
+    float diff = total ? (float)changed/total : 1.0f;
+    float growth = anchorSize ? fabs((float)(size-anchorSize))/anchorSize : 1.0f;
+    if(diff<conv_eps && growth<conv_eps && stepCount>convStart){
+        stableRuns++;
+    } else {
+        anchorSize = size;
+        anchorStep = stepCount;
+        stableRuns = 0;
+    }
+    if(converged || stableRuns < conv_patience) return;
+
+    converged = true;
+    convergedOnce = true;
+    long steps = max(0L, anchorStep - convStart);
+    if(coldRun){
+        coldSteps = steps;
+        cout<<"Network converged in "<<steps<<" steps ("<<(warmStarted?"warm":"cold")<<" start)\n";
+    } else {
+        cout<<"Network re-converged in "<<steps<<" steps";
+        if(coldSteps>0) cout<<" ("<<100.0f*steps/coldSteps<<"% of "<<(warmStarted?"warm":"cold")<<" start)";
+        cout<<"\n";
+    }
+}
+
+// ---------- Population ----------
+// With --adaptive the agent count follows the network instead of staying
+// at NUM_AGENTS. Until the network first converges the whole pool explores;
+// after that, every conv_interval steps, the target is pop_per_cell agents
+// per network cell, kept within [pop_min, NUM_AGENTS] and approached by at
+// most pop_rate of the population per check. Surplus agents retire from
+// saturated cells (trail above pop_saturate times the network threshold),
+// where plenty of others hold the network; missing agents spawn beside
+// agents exploring off the network, heading off at random. The pool is
+// reserved once: retiring moves the last agent into the gap and spawning
+// appends, so the array stays compact and nothing is allocated.
+bool adaptive = false;
+float pop_per_cell = 4.0f;
+float pop_saturate = 2.0f;
+float pop_rate = 0.1f;
+size_t pop_min = 2000;
+uint32_t nextAgentId = NUM_AGENTS;   // ids after the initial pool
+
+inline float trailUnder(const Agent &a){ return tload(trail[idx((int)a.x,(int)a.y)]); }
+
+void adaptPopulation(){
+    if(!adaptive || !convergedOnce || stepCount%conv_interval) return;
+    size_t n = agents.size();
+    size_t target = min(max((size_t)(pop_per_cell*netCells),pop_min),(size_t)NUM_AGENTS);
+    size_t limit = max((size_t)(pop_rate*n),(size_t)1);
+    if(n>target){
+        float hi = pop_saturate*netThreshold;
+        size_t sat = 0;
+        for(auto &a:agents) sat += trailUnder(a)>hi;
+        if(!sat) return;
+        float p = (float)min(n-target,limit)/sat;
+        for(size_t i=0;i<agents.size();){
+            if(trailUnder(agents[i])>hi && uni01(rng)<p){
+                agents[i] = agents.back();
+                agents.pop_back();
+            } else i++;
+        }
+    } else if(n<target){
+        size_t explore = 0;
+        for(auto &a:agents) explore += trailUnder(a)<netThreshold;
+        if(!explore) return;
+        size_t want = n+min(target-n,limit);
+        float p = (float)(want-n)/explore;
+        for(size_t i=0;i<n && agents.size()<want;i++){
+            if(trailUnder(agents[i])<netThreshold && uni01(rng)<p){
+                Agent c = agents[i];
+                c.angle = uni01(rng)*2*M_PI;
+                c.dx = cosf(c.angle);
+                c.dy = sinf(c.angle);
+                c.id = nextAgentId++;
+                agents.push_back(c);
+            }
+        }
+    }
+}
+
+// ---------- Point events ----------
+// Demand points can be added, moved, removed or reweighted while the
+// simulation runs; trail and agents are kept so the network re-converges
+// from its current (warm) state.
+enum EventType { EV_ADD, EV_MOVE, EV_REMOVE, EV_WEIGHT };
+
+struct PointEvent {
+    long step;
+    EventType type;
+    int id;
+    float x,y,w;
+};
+
+vector<PointEvent> events;   // pending, sorted by step
+size_t nextEvent = 0;
+
+Point* findPoint(int id){
+    for(auto &p:points) if(p.id==id) return &p;
+    return nullptr;
+}
+
+// --workers processes get their events already snapped by the parent and
+// keep only some rows, so they neither search nor write outside them
+bool snapPoints = true;
+
+// snap (x,y) to the closest free cell, false if none is near
+bool nearestFree(int &x,int &y){
+    for(int r=0;r<=20;r++)
+        for(int dy=-r;dy<=r;dy++)
+            for(int dx=-r;dx<=r;dx++){
+                if(max(abs(dx),abs(dy))!=r) continue;
+                int nx=x+dx, ny=y+dy;
+                if(nx>=0&&nx<GRID_W&&ny>=0&&ny<GRID_H&&maze[idx(nx,ny)]!=WALL){
+                    x=nx; y=ny;
+                    return true;
+                }
+            }
+    return false;
+}
+
+// seed the trail at a new point position so agents find it quickly
+void markPoint(int x,int y,float w){
+    if(y>=ROW0 && y<ROW1)
+        trail[idx(x,y)] = tstore(max(tload(trail[idx(x,y)]), 50.0f*w));
+    markLodDirty(x,y,x,y);
+    resetConvergence(x,y);
+}
+
+int addPoint(float x,float y,float w=1.0f){
+    int xi=(int)x, yi=(int)y;
+    if(snapPoints && !nearestFree(xi,yi)){
+        cout<<"No free cell near ("<<x<<","<<y<<"), point not added\n";
+        return -1;
+    }
+    Point p;
+    p.x = xi; p.y = yi;
+    p.weight = w;
+    p.id = nextPointId++;
+    points.push_back(p);
+    markPoint(xi,yi,w);
+    return p.id;
+}
+
+bool movePoint(int id,float x,float y){
+    Point* p = findPoint(id);
+    int xi=(int)x, yi=(int)y;
+    if(!p || (snapPoints && !nearestFree(xi,yi))) return false;
+    resetConvergence(p->x,p->y);
+    p->x = xi; p->y = yi;
+    markPoint(xi,yi,p->weight);
+    return true;
+}
+
+bool removePoint(int id){
+    for(size_t i=0;i<points.size();i++){
+        if(points[i].id!=id) continue;
+        resetConvergence(points[i].x,points[i].y);
+        points.erase(points.begin()+i);
+        return true;
+    }
+    return false;
+}
+
+bool reweightPoint(int id,float w){
+    Point* p = findPoint(id);
+    if(!p) return false;
+    p->weight = w;
+    resetConvergence(p->x,p->y);
+    return true;
+}
+
+void applyEvent(const PointEvent &e){
+    bool ok = true;
+    switch(e.type){
+        case EV_ADD: {
+            int id = addPoint(e.x,e.y,e.w);
+            ok = (id>=0);
+            if(ok) cout<<"step "<<stepCount<<": added point "<<id<<"\n";
+            break;
+        }
+        case EV_MOVE:   ok = movePoint(e.id,e.x,e.y); break;
+        case EV_REMOVE: ok = removePoint(e.id); break;
+        case EV_WEIGHT: ok = reweightPoint(e.id,e.w); break;
+    }
+    if(!ok) cout<<"step "<<stepCount<<": event on point "<<e.id<<" ignored\n";
+}
+
+// One event per line: "<step> add <x> <y> [w]", "<step> move <id> <x> <y>",
+// "<step> remove <id>" or "<step> weight <id> <w>". '#' starts a comment.
+bool parseEvent(const string &line,PointEvent &e){
+    string s = line.substr(0,line.find('#'));
+    istringstream in(s);
+    string op;
+    if(!(in>>e.step>>op)) return false;
+    e.id=-1; e.x=e.y=0; e.w=1.0f;
+    if(op=="add"){
+        e.type=EV_ADD;
+        if(!(in>>e.x>>e.y)) return false;
+        in>>e.w;
+    } else if(op=="move"){
+        e.type=EV_MOVE;
+        return (bool)(in>>e.id>>e.x>>e.y);
+    } else if(op=="remove"){
+        e.type=EV_REMOVE;
+        return (bool)(in>>e.id);
+    } else if(op=="weight"){
+        e.type=EV_WEIGHT;
+        return (bool)(in>>e.id>>e.w);
+    } else return false;
+    return true;
+}
+
+void queueEvent(const PointEvent &e){
+    auto it = events.begin()+nextEvent;
+    while(it!=events.end() && it->step<=e.step) ++it;
+    events.insert(it,e);
+}
+
+void loadEvents(const char* filename){
+    ifstream in(filename);
+    if(!in){
+        cout<<"Failed to open events file "<<filename<<"\n";
+        return;
+    }
+    string line;
+    int lineNo=0;
+    while(getline(in,line)){
+        lineNo++;
+        if(line.find_first_not_of(" \t\r")==string::npos || line[line.find_first_not_of(" \t")]=='#') continue;
+        PointEvent e;
+        if(parseEvent(line,e)) queueEvent(e);
+        else cout<<filename<<":"<<lineNo<<": bad event\n";
+    }
+}
+
+// the events of step N land after N steps, so step 0 events are applied
+// once the initial points are placed, before the first step
+void applyDueEvents(){
+    while(nextEvent<events.size() && events[nextEvent].step<=stepCount)
+        applyEvent(events[nextEvent++]);
+}
+
+
+// ---------- Wall edits ----------
+// Painting only queues the brush rectangle. applyWallEdits() runs between
+// steps and touches just the queued cells: new walls lose their trail,
+// agents and points caught inside move to the nearest free cell, and the
+// LOD tiles and convergence region around them are marked, so a stroke
+// costs the size of the brush, not of the grid.
+struct WallRect { int x0,y0,x1,y1; };   // inclusive, clipped to the grid
+vector<WallRect> wallEdits;
+
+void queueWalls(int x0,int y0,int x1,int y1){
+    x0=max(x0,0); y0=max(y0,0);
+    x1=min(x1,GRID_W-1); y1=min(y1,GRID_H-1);
+    if(x0<=x1 && y0<=y1) wallEdits.push_back({x0,y0,x1,y1});
+}
+
+// nearest free cell just outside r on the row or column of (x,y)
+bool leaveRect(const WallRect &r,int &x,int &y){
+    const int cx[4]={r.x0-1,r.x1+1,x,x}, cy[4]={y,y,r.y0-1,r.y1+1};
+    const int d[4]={x-r.x0,r.x1-x,y-r.y0,r.y1-y};
+    int best=-1;
+    for(int k=0;k<4;k++)
+        if(cx[k]>=0 && cx[k]<GRID_W && cy[k]>=0 && cy[k]<GRID_H
+           && maze[idx(cx[k],cy[k])]!=WALL && (best<0 || d[k]<d[best]))
+            best=k;
+    if(best<0) return false;
+    x=cx[best]; y=cy[best];
+    return true;
+}
+
+void applyWallEdits(){
+    if(wallEdits.empty()) return;
+    int bx0=GRID_W, by0=GRID_H, bx1=-1, by1=-1;   // box around the batch
+    for(auto &r:wallEdits){
+        for(int y=r.y0;y<=r.y1;y++)
+            for(int x=r.x0;x<=r.x1;x++){
+                maze[idx(x,y)] = WALL;
+                trail[idx(x,y)] = tstore(0.0f);
+            }
+        markLodDirty(r.x0,r.y0,r.x1,r.y1);
+        resetConvergence(r.x0,r.y0);
+        resetConvergence(r.x1,r.y1);
+        bx0=min(bx0,r.x0); by0=min(by0,r.y0);
+        bx1=max(bx1,r.x1); by1=max(by1,r.y1);
+    }
+    openMap = false;
+
+    // only agents in the box can have been caught; each steps out of the
+    // rectangle it is in, or failing that to any free cell
+    for(auto &a:agents){
+        if(a.x<bx0 || a.x>=bx1+1 || a.y<by0 || a.y>=by1+1) continue;
+        int x=(int)a.x, y=(int)a.y;
+        if(maze[idx(x,y)]!=WALL) continue;
+        bool out=false;
+        for(auto &r:wallEdits)
+            if(x>=r.x0 && x<=r.x1 && y>=r.y0 && y<=r.y1 && (out=leaveRect(r,x,y))) break;
+        if(!out && !nearestFree(x,y))
+            do{
+                x = rand() % GRID_W;
+                y = rand() % GRID_H;
+            }while(maze[idx(x,y)]==WALL);
+        a.x = x;
+        a.y = y;
     }
+    wallEdits.clear();
+    for(auto &p:points)
+        if(maze[idx(p.x,p.y)]==WALL) movePoint(p.id,p.x,p.y);
+}
+
+// ---------- View ----------
+// Visible part of the grid: zoom 1 shows all of it, centred on (viewCX,viewCY)
+int winW = WIN_W, winH = WIN_H;
+float viewZoom = 1.0f;
+float viewCX = 0, viewCY = 0;
+bool panning = false;
+int panX, panY;
+
+void viewRect(float &x0,float &y0,float &x1,float &y1){
+    float hw=GRID_W/(2*viewZoom), hh=GRID_H/(2*viewZoom);
+    viewCX=min(max(viewCX,hw),GRID_W-hw);
+    viewCY=min(max(viewCY,hh),GRID_H-hh);
+    x0=viewCX-hw; x1=viewCX+hw;
+    y0=viewCY-hh; y1=viewCY+hh;
+}
+
+void screenToGrid(int x,int y,float &gx,float &gy){
+    float x0,y0,x1,y1;
+    viewRect(x0,y0,x1,y1);
+    gx = x0 + (x1-x0)*x/winW;
+    gy = y0 + (y1-y0)*(winH-y)/winH;
+}
+
+// zoom by factor f, keeping the grid point under screen (x,y) in place
+void zoomAt(int x,int y,float f){
+    float gx,gy,x0,y0,x1,y1;
+    screenToGrid(x,y,gx,gy);
+    viewZoom=min(max(viewZoom*f,1.0f),(float)max(GRID_W,GRID_H));
+    viewRect(x0,y0,x1,y1);
+    viewCX += gx - (x0+(x1-x0)*x/winW);
+    viewCY += gy - (y0+(y1-y0)*(winH-y)/winH);
 }
 
+#ifndef ADRP_LIB
+void reshape(int w,int h){
+    winW=max(w,1); winH=max(h,1);
+    glViewport(0,0,winW,winH);
+}
 
 // ---------- Mouse ----------
 void mouse(int button, int state, int x, int y){
     if(button == GLUT_LEFT_BUTTON){
         drawing = (state == GLUT_DOWN);
     }
+    // middle drag pans, the wheel (buttons 3/4 in freeglut) zooms
+    if(button == GLUT_MIDDLE_BUTTON){
+        panning = (state == GLUT_DOWN);
+        panX = x; panY = y;
+    }
+    if(state == GLUT_DOWN && (button == 3 || button == 4))
+        zoomAt(x,y,button == 3 ? 1.25f : 0.8f);
+    // right click: remove the point under the cursor, or add one there
+    if(button == GLUT_RIGHT_BUTTON && state == GLUT_DOWN){
+        float gx,gy;
+        screenToGrid(x,y,gx,gy);
+        for(auto &p:points){
+            if(fabs(p.x-gx)<=3 && fabs(p.y-gy)<=3){
+                cout<<"step "<<stepCount<<": removed point "<<p.id<<"\n";
+                removePoint(p.id);
+                return;
+            }
+        }
+        int id = addPoint(gx,gy);
+        if(id>=0) cout<<"step "<<stepCount<<": added point "<<id<<"\n";
+    }
 }
 
 void motion(int x,int y){
+    if(panning){
+        viewCX -= (float)(x-panX)*GRID_W/(viewZoom*winW);
+        viewCY += (float)(y-panY)*GRID_H/(viewZoom*winH);
+        panX = x; panY = y;
+    }
     if(!drawing) return;
-    int gx = x * GRID_W / WIN_W;
-    int gy = (WIN_H - y) * GRID_H / WIN_H;
-    for(int dy=-brush_size; dy<=brush_size; dy++){
-        for(int dx=-brush_size; dx<=brush_size; dx++){
-            int nx=gx+dx, ny=gy+dy;
-            if(nx>=0&&nx<GRID_W&&ny>=0&&ny<GRID_H)
-                maze[idx(nx,ny)] = 1;
-        }
+    float fx,fy;
+    screenToGrid(x,y,fx,fy);
+    int gx = (int)fx, gy = (int)fy;
+    queueWalls(gx-brush_size,gy-brush_size,gx+brush_size,gy+brush_size);
+}
+
+// ---------- Keyboard ----------
+void setFastTrig(bool on);
+
+void keyboard(unsigned char key,int x,int y){
+    if(key=='t'){
+        setFastTrig(!fast_trig);
+        cout<<(fast_trig ? "fast trig on" : "fast trig off")<<endl;
+    }
+    if(key=='+' || key=='=') zoomAt(winW/2,winH/2,1.25f);
+    if(key=='-') zoomAt(winW/2,winH/2,0.8f);
+    if(key=='0') viewZoom=1.0f;
+    if(key=='[' || key==']'){
+        brush_size = max(0,brush_size+(key==']' ? 1 : -1));
+        cout<<"brush size "<<2*brush_size+1<<endl;
     }
 }
 
+// arrow keys pan by a tenth of the view
+void special(int key,int x,int y){
+    float x0,y0,x1,y1;
+    viewRect(x0,y0,x1,y1);
+    if(key==GLUT_KEY_LEFT)  viewCX -= (x1-x0)*0.1f;
+    if(key==GLUT_KEY_RIGHT) viewCX += (x1-x0)*0.1f;
+    if(key==GLUT_KEY_DOWN)  viewCY -= (y1-y0)*0.1f;
+    if(key==GLUT_KEY_UP)    viewCY += (y1-y0)*0.1f;
+}
+#endif
+
 // ---------- Trail sampling ----------
+template<bool Walls=true>
 inline float sampleTrail(float x,float y){
     int xi=(int)x, yi=(int)y;
-    if(xi<0||xi>=GRID_W||yi<0||yi>=GRID_H) return 0;
-    if(maze[idx(xi,yi)]==1) return 0;
-    return trail[idx(xi,yi)];
+    if(xi<0||xi>=GRID_W||yi<ROW0||yi>=ROW1) return 0;
+    if(Walls && maze[idx(xi,yi)]==WALL) return 0;
+    return tload(trail[idx(xi,yi)]);
 }
 
 // ---------- Deposit ----------
 inline void deposit(float x,float y,float amt){
     int xi=(int)x, yi=(int)y;
-    if(xi<0||xi>=GRID_W||yi<0||yi>=GRID_H) return;
-    if(maze[idx(xi,yi)]==0)
-        trail[idx(xi,yi)] += amt;
+    if(xi<0||xi>=GRID_W||yi<ROW0||yi>=ROW1) return;
+    if(maze[idx(xi,yi)]!=WALL)
+        tadd(trail[idx(xi,yi)],amt);
 }
 
-// ---------- Agent update ----------
-void updateAgents(){
-    for(auto &a:agents){
-        float ax=a.x+cos(a.angle)*sensor_distance;
-        float ay=a.y+sin(a.angle)*sensor_distance;
-        float lx=a.x+cos(a.angle+sensor_angle)*sensor_distance;
-        float ly=a.y+sin(a.angle+sensor_angle)*sensor_distance;
-        float rx=a.x+cos(a.angle-sensor_angle)*sensor_distance;
-        float ry=a.y+sin(a.angle-sensor_angle)*sensor_distance;
+// agent deposit, scaled by the terrain of the cell it lands in
+template<bool Walls=true>
+inline void depositTerrain(float x,float y,float amt){
+    int xi=(int)x, yi=(int)y;
+    if(xi<0||xi>=GRID_W||yi<ROW0||yi>=ROW1) return;
+    tadd(trail[idx(xi,yi)],Walls ? amt*terrainDeposit[maze[idx(xi,yi)]] : amt);
+}
 
-        float f=sampleTrail(ax,ay);
-        float l=sampleTrail(lx,ly);
-        float r=sampleTrail(rx,ry);
+// Sorted deposit. With --sort-deposit the deposit phase of a sync step
+// (depositAgents) first collects every agent's (cell, amount), counting-
+// sorts the pairs by DEPOSIT_TILE x DEPOSIT_TILE tile of the stored rows
+// and then adds them tile by tile, so the writes walk the trail a tile at
+// a time instead of jumping to a random cache line per agent. The sort is
+// stable and the agents are in id order, so each cell gets its deposits in
+// the order of the direct loop and the trail is the same bit for bit.
+// --deposit-threads n splits collecting, sorting and applying over n
+// threads: chunks of agents stay in id order and each thread applies whole
+// tiles, so the result does not depend on n either.
+const int DEPOSIT_TILE = 32;
 
-        if(l>f && l>r) a.angle+=turn_angle;
-        else if(r>f && r>l) a.angle-=turn_angle;
-        else a.angle+=(uni01(rng)-0.5f)*0.2f;
+struct FieldDeposit {
+    size_t cell;
+    float amt;
+};
 
-        a.angle+=(uni01(rng)-0.5f)*0.3f;
+bool sort_deposit = false;
+int deposit_threads = 1;
+vector<FieldDeposit> depositLog, depositSorted;
+vector<uint32_t> depositKey;
+vector<size_t> depositPos;    // per thread and tile: next slot in depositSorted
 
-        float nx=a.x+cos(a.angle)*step_size;
-        float ny=a.y+sin(a.angle)*step_size;
+// run f(0..n-1), f(0) on the calling thread
+template<class F>
+void parallelFor(int n,F f){
+    vector<thread> th;
+    for(int t=1;t<n;t++) th.emplace_back(f,t);
+    f(0);
+    for(auto &t:th) t.join();
+}
 
-        if(nx>=0&&nx<GRID_W&&ny>=0&&ny<GRID_H&&maze[idx((int)nx,(int)ny)]==0){
-            a.x=nx; a.y=ny;
-        } else {
-            a.angle+=M_PI*(uni01(rng)-0.5f);
+template<bool Walls>
+void depositByTile(float amt){
+    const int tilesX=(GRID_W+DEPOSIT_TILE-1)/DEPOSIT_TILE;
+    const uint32_t keys=(uint32_t)tilesX*((ROW1-ROW0+DEPOSIT_TILE-1)/DEPOSIT_TILE);
+    const size_t n=agents.size();
+    const int T=max(1,min(deposit_threads,(int)(n/4096)+1));
+    depositLog.resize(n);
+    depositSorted.resize(n);
+    depositKey.resize(n);
+    depositPos.assign((size_t)T*(keys+1),0);   // key `keys`: off the stored rows
+    auto chunk=[&](int t){ return n*t/T; };
+
+    // collect and count per thread
+    parallelFor(T,[&](int t){
+        size_t *cnt=&depositPos[(size_t)t*(keys+1)];
+        for(size_t k=chunk(t);k<chunk(t+1);k++){
+            const Agent &a=agents[k];
+            int xi=(int)a.x, yi=(int)a.y;
+            uint32_t key=keys;
+            if(xi>=0 && xi<GRID_W && yi>=ROW0 && yi<ROW1){
+                depositLog[k]={idx(xi,yi),amt};
+                key=(uint32_t)((yi-ROW0)/DEPOSIT_TILE)*tilesX+xi/DEPOSIT_TILE;
+            }
+            depositKey[k]=key;
+            cnt[key]++;
         }
+    });
 
-        deposit(a.x,a.y,deposit_amount);
+    // tile-major, thread-minor offsets keep the sort stable in id order
+    vector<size_t> tileStart(keys+1);
+    size_t run=0;
+    for(uint32_t key=0;key<=keys;key++){
+        tileStart[key]=run;
+        for(int t=0;t<T;t++){
+            size_t c=depositPos[(size_t)t*(keys+1)+key];
+            depositPos[(size_t)t*(keys+1)+key]=run;
+            run+=c;
+        }
     }
+    parallelFor(T,[&](int t){
+        size_t *pos=&depositPos[(size_t)t*(keys+1)];
+        for(size_t k=chunk(t);k<chunk(t+1);k++) depositSorted[pos[depositKey[k]]++]=depositLog[k];
+    });
 
-    // reinforce food (emergency demand)
-    for(auto &p:points)
-        deposit(p.x,p.y,10.0f);
+    // apply; thread t takes the tiles starting in its share of the pairs
+    const size_t total=tileStart[keys];
+    parallelFor(T,[&](int t){
+        size_t e0=*lower_bound(tileStart.begin(),tileStart.end(),total*t/T);
+        size_t e1=*lower_bound(tileStart.begin(),tileStart.end(),total*(t+1)/T);
+        for(size_t e=e0;e<e1;e++){
+            size_t i=depositSorted[e].cell;
+            tadd(trail[i],Walls ? depositSorted[e].amt*terrainDeposit[maze[i]] : depositSorted[e].amt);
+        }
+    });
 }
 
-// ---------- Diffusion ----------
-void diffuse(){
-    vector<float> tmp=trail;
-    for(int y=1;y<GRID_H-1;y++){
-        for(int x=1;x<GRID_W-1;x++){
-            if(maze[idx(x,y)]) continue;
-            float s=0; int c=0;
-            for(int dy=-1;dy<=1;dy++)
-                for(int dx=-1;dx<=1;dx++){
-                    if(!maze[idx(x+dx,y+dy)]){
-                        s+=trail[idx(x+dx,y+dy)];
-                        c++;
-                    }
-                }
-            tmp[idx(x,y)]=trail[idx(x,y)]*(1-diffusion_rate)+(s/c)*diffusion_rate;
-        }
+// ---------- Fast trigonometry ----------
+// With fast_trig on, agents steer a unit heading vector instead of an angle:
+// the sensor offsets and the fixed turns become rotations by constants
+// computed once per step, and the random turns use fastSinCos(). That
+// leaves one polynomial sincos per agent step instead of eight cos/sin
+// calls. Accuracy: fastSinCos is within 2e-7 of sinf/cosf for |a| < 4
+// (4e-6 at |a| = 100; agent turns stay below pi/2). The heading is
+// renormalised every step so its length stays at 1 +- 6e-8, and over 1e6
+// random rotations its direction wandered 1.4e-5 rad from the summed
+// angle, far below the random jitter each step adds anyway.
+
+inline void fastSinCos(float a,float &s,float &c){
+    float q = nearbyintf(a*0.63661977f);             // nearest quarter turn
+    float r = a - q*1.57079637f - q*(-4.37113883e-8f);
+    float r2 = r*r;
+    float sr = r + r*r2*(-1.66666667e-1f + r2*(8.33333333e-3f
+             + r2*(-1.98412698e-4f + r2*2.75573192e-6f)));
+    float cr = 1.0f + r2*(-0.5f + r2*(4.16666667e-2f
+             + r2*(-1.38888889e-3f + r2*2.48015873e-5f)));
+    switch((int)q & 3){
+        case 0:  s= sr; c= cr; break;
+        case 1:  s= cr; c=-sr; break;
+        case 2:  s=-sr; c=-cr; break;
+        default: s=-cr; c= sr; break;
     }
-    trail.swap(tmp);
 }
 
-void evaporate(){
-    for(float &v:trail) v*=(1.0f-evaporation);
+inline void rotate(float &dx,float &dy,float c,float s){
+    float t=dx*c-dy*s;
+    dy=dx*s+dy*c;
+    dx=t;
 }
 
-// ---------- Display ----------
-void display(){
-    glClear(GL_COLOR_BUFFER_BIT);
+// switching keeps every agent's heading, whichever form was current
+void setFastTrig(bool on){
+    if(on==fast_trig) return;
+    for(auto &a:agents){
+        if(on){ a.dx=cosf(a.angle); a.dy=sinf(a.angle); }
+        else a.angle=atan2f(a.dy,a.dx);
+    }
+    fast_trig = on;
+}
 
-    updateAgents();
-    diffuse();
-    evaporate();
+// ---------- Agent update ----------
+// By default agents update in array order, each sensing the deposits of the
+// ones before it and drawing from the shared rng stream. With sync_update
+// (--sync, implied by --workers) a step is two phases: every agent senses
+// and moves against the trail as it was at the start of the step, then all
+// deposit in id order, and the random numbers come from a hash of (seed,
+// agent id, step). The result then no longer depends on how the agents are
+// split up or ordered, so a --workers run matches a --sync run bit for bit.
+//
+// The kernels are also specialised on the layer's Walls flag. On an open
+// map (openMap: no walls and all roads at full speed, as in synthetic
+// benchmarks) Walls is false and sensing, moving, depositing and diffusion
+// never load the maze. The open kernels give the same trail bit for bit,
+// except that with FMA contraction (-march=native) the two diffusion
+// sweeps round differently. The flag is picked once per step, outside
+// every agent and cell loop, and drawing a wall turns it off.
+struct StreamRng {
+    StreamRng(const Agent&){}
+    float operator()(){ return uni01(rng); }
+};
 
-    float maxTrail=0;
-    for(float v:trail) maxTrail=max(maxTrail,v);
-    if(maxTrail<1e-5) maxTrail=1;
+uint64_t sync_seed = 0;
 
-    glBegin(GL_POINTS);
+inline uint64_t mix64(uint64_t z){
+    z=(z^(z>>30))*0xbf58476d1ce4e5b9ull;
+    z=(z^(z>>27))*0x94d049bb133111ebull;
+    return z^(z>>31);
+}
 
-    // Trail field
-    for(int y=0;y<GRID_H;y++){
-        for(int x=0;x<GRID_W;x++){
-            float v=trail[idx(x,y)];
-            if(v>0.01f){
-                float c=v/maxTrail;
-                glColor3f(c,c,c);
-                glVertex2f((float)x/GRID_W*2-1,(float)y/GRID_H*2-1);
-            }
-        }
+struct AgentRng {
+    uint64_t s;
+    AgentRng(const Agent &a){ s=mix64(sync_seed^mix64(((uint64_t)a.id<<32)|(uint32_t)stepCount)); }
+    float operator()(){
+        s+=0x9e3779b97f4a7c15ull;
+        return (mix64(s)>>40)*(1.0f/16777216.0f);
     }
+};
 
-    // Agents (colored by local demand)
-    for(auto &a:agents){
-        float v=sampleTrail(a.x,a.y);
-        float c=v/maxTrail;
-        glColor3f(c,0.2f,1.0f-c); // heat-style
-        glVertex2f(a.x/GRID_W*2-1,a.y/GRID_H*2-1);
-    }
+// The trail agents sense and deposit into: the trail itself, or one replica
+// of an ensemble (see Ensemble)
+template<bool Walls>
+struct TrailLayer {
+    static constexpr bool walls = Walls;
+    float sample(float x,float y) const { return sampleTrail<Walls>(x,y); }
+    void depositAgent(float x,float y,float amt) const { depositTerrain<Walls>(x,y,amt); }
+};
 
-    // Food (emergencies)
-    for(auto &p:points){
-        glColor3f(1,0,0);
-        glVertex2f(p.x/GRID_W*2-1,p.y/GRID_H*2-1);
-    }
+template<class Rng,bool Sync,class Layer>
+void updateAgentsExact(const Layer &L,Agent *from,Agent *to){
+    for(Agent *it=from;it!=to;++it){
+        Agent &a=*it;
+        Rng rnd(a);
+        float ax=a.x+cosf(a.angle)*sensor_distance;
+        float ay=a.y+sinf(a.angle)*sensor_distance;
+        float lx=a.x+cosf(a.angle+sensor_angle)*sensor_distance;
+        float ly=a.y+sinf(a.angle+sensor_angle)*sensor_distance;
+        float rx=a.x+cosf(a.angle-sensor_angle)*sensor_distance;
+        float ry=a.y+sinf(a.angle-sensor_angle)*sensor_distance;
 
-    // Walls
-    glColor3f(0,0,1);
-    for(int y=0;y<GRID_H;y++)
-        for(int x=0;x<GRID_W;x++)
-            if(maze[idx(x,y)])
-                glVertex2f(x/(float)GRID_W*2-1,y/(float)GRID_H*2-1);
+        float f=L.sample(ax,ay);
+        float l=L.sample(lx,ly);
+        float r=L.sample(rx,ry);
 
-    glEnd();
+        if(l>f && l>r) a.angle+=turn_angle;
+        else if(r>f && r>l) a.angle-=turn_angle;
+        else a.angle+=(rnd()-0.5f)*0.2f;
 
-    glutSwapBuffers();
-    glutPostRedisplay();
+        a.angle+=(rnd()-0.5f)*0.3f;
 
-    cnt++;
+        float nx=a.x+cosf(a.angle)*step_size;
+        float ny=a.y+sinf(a.angle)*step_size;
 
-    auto now = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double> elapsed = now - last;
+        // one maze lookup gives both the wall test and the terrain speed
+        float sp=0;
+        if(nx>=0&&nx<GRID_W&&ny>=ROW0&&ny<ROW1)
+            sp=Layer::walls ? terrainSpeed[maze[idx((int)nx,(int)ny)]] : 1.0f;
 
-    if (elapsed.count() >= 1.0){
-        cout << cnt / elapsed.count() << " FPS" << endl;
-        cnt = 0;
-        last = now;
+        if(sp>0){
+            a.x+=(nx-a.x)*sp; a.y+=(ny-a.y)*sp;
+        } else {
+            a.angle+=M_PI*(rnd()-0.5f);
+        }
+
+        if(!Sync) L.depositAgent(a.x,a.y,deposit_amount);
     }
 }
 
-// ---------- Main ----------
-int main(int argc,char**argv){
-    loadMap("map.png");
-    srand(time(0));
+// Same steering as updateAgentsExact(), on the heading vector. The random
+// turns of one step are summed and applied as a single rotation.
+template<class Rng,bool Sync,class Layer>
+void updateAgentsFast(const Layer &L,Agent *from,Agent *to){
+    float cs=cosf(sensor_angle), ss=sinf(sensor_angle);
+    float ct=cosf(turn_angle), st=sinf(turn_angle);
+    for(Agent *it=from;it!=to;++it){
+        Agent &a=*it;
+        Rng rnd(a);
+        float dx=a.dx, dy=a.dy;
+        float ax=a.x+dx*sensor_distance;
+        float ay=a.y+dy*sensor_distance;
+        float lx=a.x+(dx*cs-dy*ss)*sensor_distance;
+        float ly=a.y+(dx*ss+dy*cs)*sensor_distance;
+        float rx=a.x+(dx*cs+dy*ss)*sensor_distance;
+        float ry=a.y+(dy*cs-dx*ss)*sensor_distance;
+
+        float f=L.sample(ax,ay);
+        float l=L.sample(lx,ly);
+        float r=L.sample(rx,ry);
+
+        float turn=0, s, c;
+        if(l>f && l>r) rotate(dx,dy,ct,st);
+        else if(r>f && r>l) rotate(dx,dy,ct,-st);
+        else turn+=(rnd()-0.5f)*0.2f;
+
+        turn+=(rnd()-0.5f)*0.3f;
+        fastSinCos(turn,s,c);
+        rotate(dx,dy,c,s);
+
+        // one Newton step keeps the heading at unit length
+        float k=1.5f-0.5f*(dx*dx+dy*dy);
+        dx*=k; dy*=k;
+
+        float nx=a.x+dx*step_size;
+        float ny=a.y+dy*step_size;
+
+        float sp=0;
+        if(nx>=0&&nx<GRID_W&&ny>=ROW0&&ny<ROW1)
+            sp=Layer::walls ? terrainSpeed[maze[idx((int)nx,(int)ny)]] : 1.0f;
+
+        if(sp>0){
+            a.x+=(nx-a.x)*sp; a.y+=(ny-a.y)*sp;
+        } else {
+            fastSinCos((float)M_PI*(rnd()-0.5f),s,c);
+            rotate(dx,dy,c,s);
+        }
+        a.dx=dx; a.dy=dy;
+
+        if(!Sync) L.depositAgent(a.x,a.y,deposit_amount);
+    }
+}
+
+// sense, steer and move agents [from,to); outside sync_update this also deposits
+template<class Layer>
+void moveAgentsOn(const Layer &L,Agent *from,Agent *to){
+    if(sync_update){
+        if(fast_trig) updateAgentsFast<AgentRng,true>(L,from,to);
+        else updateAgentsExact<AgentRng,true>(L,from,to);
+    } else {
+        if(fast_trig) updateAgentsFast<StreamRng,false>(L,from,to);
+        else updateAgentsExact<StreamRng,false>(L,from,to);
+    }
+}
+
+template<class Layer>
+void moveAgentsOn(const Layer &L){ moveAgentsOn(L,agents.data(),agents.data()+agents.size()); }
+
+void moveAgents(){
+    if(openMap) moveAgentsOn(TrailLayer<false>());
+    else moveAgentsOn(TrailLayer<true>());
+}
+
+// second phase of a sync_update step; agents are kept sorted by id
+void depositAgents(){
+    if(sort_deposit){
+        if(openMap) depositByTile<false>(deposit_amount);
+        else depositByTile<true>(deposit_amount);
+    }
+    else if(openMap) for(auto &a:agents) depositTerrain<false>(a.x,a.y,deposit_amount);
+    else for(auto &a:agents) depositTerrain<true>(a.x,a.y,deposit_amount);
+}
+
+// reinforce food (emergency demand)
+void depositFood(){
+    for(auto &p:points)
+        deposit(p.x,p.y,10.0f*p.weight);
+}
+
+void updateAgents(){
+    moveAgents();
+    if(sync_update) depositAgents();
+    depositFood();
+}
+
+// ---------- Diffusion ----------
+// Writes every cell of trailTmp (walls and the border keep their value), so
+// the buffer is reused between steps instead of copying the whole trail.
+// The 3x3 walk is branch-free so the row loop vectorizes for every
+// trail_t; the sweep is then bound by memory traffic, not by branches.
+
+// one row: trail rows tu/tc/td and their maze rows in, out gets the row
+// (times decay with Evaporate, the same as a following evaporate())
+template<bool Walls,bool Evaporate=false>
+inline void diffuseRow(const trail_t *tu,const trail_t *tc,const trail_t *td,
+                       const unsigned char *mu,const unsigned char *mc,const unsigned char *md,
+                       trail_t *out,float decay=1.0f){
+    const float keep = 1-diffusion_rate;
+    out[0]=Evaporate ? tscale(tc[0],decay) : tc[0];
+    out[GRID_W-1]=Evaporate ? tscale(tc[GRID_W-1],decay) : tc[GRID_W-1];
+    for(int x=1;x<GRID_W-1;x++){
+        tsum_t s=0, c=0;
+        for(int dx=-1;dx<=1;dx++){
+            tsum_t fu=!Walls||mu[x+dx]!=WALL, fc=!Walls||mc[x+dx]!=WALL, fd=!Walls||md[x+dx]!=WALL;
+            s+=fu*tu[x+dx]+fc*tc[x+dx]+fd*td[x+dx];
+            c+=fu+fc+fd;
+        }
+        float v=tload(tc[x])*keep+(tsum(s)/(c+(c==0)))*diffusion_rate;
+        trail_t r=tstore(v);
+        r=(Walls && mc[x]==WALL) ? tc[x] : r;
+        out[x]=Evaporate ? tscale(r,decay) : r;
+    }
+}
+
+// rows [y0,y1) of trailTmp; rows y0-1 and y1 must be stored
+template<bool Walls=true>
+void diffuseRows(int y0,int y1){
+    for(int y=y0;y<y1;y++)
+        diffuseRow<Walls>(&trail[idx(0,y-1)],&trail[idx(0,y)],&trail[idx(0,y+1)],
+                          &maze[idx(0,y-1)],&maze[idx(0,y)],&maze[idx(0,y+1)],
+                          &trailTmp[idx(0,y)]);
+}
+
+void diffuse(){
+    trailTmp.resize(trail.size());
+    copy(trail.begin(),trail.begin()+GRID_W,trailTmp.begin());
+    copy(trail.end()-GRID_W,trail.end(),trailTmp.end()-GRID_W);
+    if(openMap) diffuseRows<false>(ROW0+1,ROW1-1);
+    else diffuseRows<true>(ROW0+1,ROW1-1);
+    trail.swap(trailTmp);
+}
+
+void evaporate(){
+    for(trail_t &v:trail) v=tscale(v,1.0f-evaporation);
+}
+
+// ---------- Temporal blocking ----------
+// --field-block T (headless) advances the field T steps per pass over the
+// grid instead of one. Agents run T steps first, sensing the trail as it
+// was at the start of the block, and their deposits (and the food) are
+// logged per step instead of written. The grid is then swept in bands of
+// rows: a band is copied with T halo rows on either side into a scratch
+// buffer that stays in cache, and each of the T sub-steps folds in that
+// step's deposits, then diffuses and evaporates, the valid rows shrinking
+// by one per side per sub-step. Only the band's own rows are written back.
+// Per T steps the field then reads the trail and maze about once and
+// writes the trail once, where the step-by-step sweeps read and write it
+// 2T times. Given the same deposits the result is bit for bit that of T
+// diffuse() and evaporate() calls; the agents differ from a default run
+// only in seeing deposits up to T-1 steps late. Blocks end on convergence
+// checks, and events and wall edits apply between blocks.
+const size_t FIELD_BAND_BYTES = 4<<20;   // scratch rows of a band, kept in the cache
+
+int field_block = 1;
+vector<FieldDeposit> fieldLog, fieldSorted;
+vector<size_t> fieldLogStart;    // log entries of sub-step t start at fieldLogStart[t]
+vector<size_t> fieldBucket;      // sorted entries of (t, band) start at fieldBucket[t*bands+band]
+vector<trail_t> bandA, bandB;
+
+template<bool Walls>
+struct LogLayer {
+    static constexpr bool walls = Walls;
+    float sample(float x,float y) const { return sampleTrail<Walls>(x,y); }
+    void depositAgent(float x,float y,float amt) const {
+        int xi=(int)x, yi=(int)y;
+        if(xi<0||xi>=GRID_W||yi<ROW0||yi>=ROW1) return;
+        size_t i=idx(xi,yi);
+        fieldLog.push_back({i,Walls ? amt*terrainDeposit[maze[i]] : amt});
+    }
+};
+
+// bucket the logged deposits by sub-step and band, keeping their order
+void sortFieldLog(int T,int bandRows,int bands){
+    fieldBucket.assign((size_t)T*bands+1,0);
+    for(int t=0;t<T;t++)
+        for(size_t k=fieldLogStart[t];k<fieldLogStart[t+1];k++)
+            fieldBucket[t*bands+fieldLog[k].cell/GRID_W/bandRows+1]++;
+    for(size_t b=1;b<fieldBucket.size();b++) fieldBucket[b]+=fieldBucket[b-1];
+    fieldSorted.resize(fieldLog.size());
+    vector<size_t> pos(fieldBucket.begin(),fieldBucket.end()-1);
+    for(int t=0;t<T;t++)
+        for(size_t k=fieldLogStart[t];k<fieldLogStart[t+1];k++)
+            fieldSorted[pos[t*bands+fieldLog[k].cell/GRID_W/bandRows]++]=fieldLog[k];
+}
+
+// T sub-steps of deposit, diffuse() and evaporate(), band by band
+template<bool Walls>
+void fieldBlock(int T){
+    const size_t W=GRID_W;
+    const float decay=1.0f-evaporation;
+    int bandRows=max(2*T,(int)(FIELD_BAND_BYTES/(W*(2*sizeof(trail_t)+1)))-2*T);
+    int bands=(GRID_H+bandRows-1)/bandRows;
+    sortFieldLog(T,bandRows,bands);
+    trailTmp.resize(trail.size());
+    bandA.resize((bandRows+2*T)*W);
+    bandB.resize((bandRows+2*T)*W);
+
+    for(int b=0;b<bands;b++){
+        int y0=b*bandRows, y1=min(y0+bandRows,GRID_H);
+        int e0=max(y0-T,0), e1=min(y1+T,GRID_H);
+        copy(&trail[idx(0,e0)],&trail[idx(0,e0)]+(e1-e0)*W,bandA.begin());
+        for(int t=0;t<T;t++){
+            // deposits within T rows of the band lie in it or its neighbours
+            for(int nb=max(b-1,0);nb<=min(b+1,bands-1);nb++)
+                for(size_t k=fieldBucket[t*bands+nb];k<fieldBucket[t*bands+nb+1];k++){
+                    const FieldDeposit &d=fieldSorted[k];
+                    int y=d.cell/W;
+                    if(y>=e0 && y<e1) tadd(bandA[d.cell-e0*W],d.amt);
+                }
+            int lo = e0==0 ? 0 : e0+t+1, hi = e1==GRID_H ? GRID_H : e1-t-1;
+            for(int y=lo;y<hi;y++){
+                const trail_t *tc=&bandA[(y-e0)*W];
+                trail_t *out=&bandB[(y-e0)*W];
+                if(y==0 || y==GRID_H-1)
+                    for(size_t x=0;x<W;x++) out[x]=tscale(tc[x],decay);
+                else diffuseRow<Walls,true>(tc-W,tc,tc+W,&maze[idx(0,y-1)],&maze[idx(0,y)],&maze[idx(0,y+1)],out,decay);
+            }
+            bandA.swap(bandB);
+        }
+        copy(&bandA[(y0-e0)*W],&bandA[(y1-e0)*W],&trailTmp[idx(0,y0)]);
+    }
+    trail.swap(trailTmp);
+}
+
+// ---------- Tile scheduler ----------
+// --threads n runs the --sync update on n threads of this process. A step
+// is split into tile tasks: the agents on each SCHED_TILE x SCHED_TILE
+// tile sense and move, then the agents of each tile (re-bucketed by their
+// new cells) deposit, then bands of SCHED_TILE rows diffuse and evaporate.
+// Each phase deals its tasks to per-thread queues, costliest first, with
+// the tiles' times from the previous step as the estimate (tiles new to a
+// phase are costed by agent count). A thread works through its own queue
+// from the front and, once it is empty, steals from the back of the
+// others'. Within a tile the agents are kept in id order, so every cell
+// gets its deposits in the order of a --sync run and the trail matches it
+// bit for bit for any thread count. The headless report gives each
+// thread's busy share of the parallel phases and how many tasks it stole.
+const int SCHED_TILE = 32;
+
+struct TaskQueue {
+    mutex m;
+    deque<int> q;
+};
+
+struct ThreadStats {
+    double busy = 0;
+    long tasks = 0, stolen = 0;
+};
+
+int step_threads = 0;
+vector<thread> schedPool;
+vector<TaskQueue> schedQueues;
+vector<ThreadStats> threadStats;
+double schedWall = 0;        // seconds spent in parallel phases
+mutex schedMutex;
+condition_variable schedGo, schedDone;
+function<void(int)> schedJob;
+long schedGen = 0;
+int schedRunning = 0;
+bool schedQuit = false;
+
+int schedTilesX = 0, schedTiles = 0;
+vector<size_t> tileStart;             // agents of tile k: [tileStart[k], tileStart[k+1])
+vector<size_t> tileCount;             // per chunk and tile, then scatter positions
+AgentVec agentsTmp;
+vector<float> moveCost, depositCost, fieldCost;
+
+// run f(t) once on every thread, f(0) on the calling one
+void schedRun(const function<void(int)> &f){
+    {
+        lock_guard<mutex> lk(schedMutex);
+        schedJob = f;
+        schedRunning = step_threads-1;
+        schedGen++;
+    }
+    schedGo.notify_all();
+    f(0);
+    unique_lock<mutex> lk(schedMutex);
+    schedDone.wait(lk,[]{ return schedRunning==0; });
+}
+
+void schedWorker(int t){
+    long seen = 0;
+    for(;;){
+        function<void(int)> f;
+        {
+            unique_lock<mutex> lk(schedMutex);
+            schedGo.wait(lk,[&]{ return schedQuit || schedGen!=seen; });
+            if(schedQuit) return;
+            seen = schedGen;
+            f = schedJob;
+        }
+        f(t);
+        lock_guard<mutex> lk(schedMutex);
+        if(--schedRunning==0) schedDone.notify_one();
+    }
+}
+
+void stopScheduler(){
+    {
+        lock_guard<mutex> lk(schedMutex);
+        schedQuit = true;
+    }
+    schedGo.notify_all();
+    for(auto &t:schedPool) t.join();
+    schedPool.clear();
+}
+
+void startScheduler(int n){
+    step_threads = n;
+    schedQueues = vector<TaskQueue>(n);
+    threadStats.assign(n,ThreadStats());
+    for(int t=1;t<n;t++) schedPool.emplace_back(schedWorker,t);
+    atexit(stopScheduler);   // also when the window closes
+    schedTilesX = (GRID_W+SCHED_TILE-1)/SCHED_TILE;
+    schedTiles = schedTilesX*((GRID_H+SCHED_TILE-1)/SCHED_TILE);
+}
+
+// Run task(k) for every k in tasks. est[k] orders and deals the tasks and
+// afterwards holds each one's measured time.
+template<class F>
+void runTasks(vector<int> &tasks,vector<float> &est,F task){
+    const int n = step_threads;
+    sort(tasks.begin(),tasks.end(),[&](int a,int b){ return est[a]>est[b]; });
+    // deal greedily to the thread with the least estimated work
+    vector<double> load(n,0.0);
+    for(int t=0;t<n;t++) schedQueues[t].q.clear();
+    for(int k:tasks){
+        int t = min_element(load.begin(),load.end())-load.begin();
+        schedQueues[t].q.push_back(k);
+        load[t] += est[k];
+    }
+    auto t0 = std::chrono::high_resolution_clock::now();
+    schedRun([&](int t){
+        ThreadStats &st = threadStats[t];
+        for(;;){
+            int k = -1;
+            bool stole = false;
+            {
+                lock_guard<mutex> lk(schedQueues[t].m);
+                if(!schedQueues[t].q.empty()){ k=schedQueues[t].q.front(); schedQueues[t].q.pop_front(); }
+            }
+            for(int i=1;i<n && k<0;i++){
+                TaskQueue &v = schedQueues[(t+i)%n];
+                lock_guard<mutex> lk(v.m);
+                if(!v.q.empty()){ k=v.q.back(); v.q.pop_back(); stole=true; }
+            }
+            if(k<0) return;
+            auto a = std::chrono::high_resolution_clock::now();
+            task(k);
+            double d = std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-a).count();
+            est[k] = d;
+            st.busy += d;
+            st.tasks++;
+            st.stolen += stole;
+        }
+    });
+    schedWall += std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-t0).count();
+}
+
+inline int tileOfAgent(const Agent &a){
+    int tx = min(max((int)a.x,0),GRID_W-1)/SCHED_TILE;
+    int ty = min(max((int)a.y,0),GRID_H-1)/SCHED_TILE;
+    return ty*schedTilesX+tx;
+}
+
+// stable counting sort of the agents by tile, on every thread
+void bucketAgents(){
+    const int n = step_threads;
+    const size_t N = agents.size();
+    const size_t K = schedTiles;
+    auto chunk = [&](int t){ return N*t/n; };
+    tileCount.assign(n*K,0);
+    schedRun([&](int t){
+        size_t *c = &tileCount[t*K];
+        for(size_t i=chunk(t);i<chunk(t+1);i++) c[tileOfAgent(agents[i])]++;
+    });
+    tileStart.assign(K+1,0);
+    size_t run = 0;
+    for(size_t k=0;k<K;k++){
+        tileStart[k] = run;
+        for(int t=0;t<n;t++){
+            size_t c = tileCount[t*K+k];
+            tileCount[t*K+k] = run;
+            run += c;
+        }
+    }
+    tileStart[K] = run;
+    agentsTmp.resize(N);
+    schedRun([&](int t){
+        size_t *pos = &tileCount[t*K];
+        for(size_t i=chunk(t);i<chunk(t+1);i++) agentsTmp[pos[tileOfAgent(agents[i])]++] = agents[i];
+    });
+    agents.swap(agentsTmp);
+}
+
+// tiles holding agents; unmeasured ones are estimated from their agent count
+vector<int> agentTiles(vector<float> &est,double perAgent){
+    vector<int> tasks;
+    for(int k=0;k<schedTiles;k++){
+        size_t m = tileStart[k+1]-tileStart[k];
+        if(!m) continue;
+        tasks.push_back(k);
+        if(est[k]<=0) est[k] = m*perAgent;
+    }
+    return tasks;
+}
+
+// sense and move, then deposit, tile by tile
+template<bool Walls>
+void updateAgentsTiled(){
+    const size_t N = max(agents.size(),(size_t)1);
+    if(tileStart.size()!=(size_t)schedTiles+1){
+        moveCost.assign(schedTiles,0.0f);
+        depositCost.assign(schedTiles,0.0f);
+        fieldCost.assign((GRID_H+SCHED_TILE-1)/SCHED_TILE,0.0f);
+        bucketAgents();
+    }
+    double moveSum = 0, depositSum = 0;
+    for(float c:moveCost) moveSum += c;
+    for(float c:depositCost) depositSum += c;
+
+    vector<int> tasks = agentTiles(moveCost,moveSum>0 ? moveSum/N : 1e-7);
+    runTasks(tasks,moveCost,[&](int k){
+        moveAgentsOn(TrailLayer<Walls>(),agents.data()+tileStart[k],agents.data()+tileStart[k+1]);
+    });
+
+    // agents moved into other tiles; within a tile restore id order, which
+    // is nearly kept by the stable bucketing, so insertion sort is cheap
+    bucketAgents();
+    tasks = agentTiles(depositCost,depositSum>0 ? depositSum/N : 1e-8);
+    runTasks(tasks,depositCost,[&](int k){
+        Agent *b = agents.data()+tileStart[k], *e = agents.data()+tileStart[k+1];
+        for(Agent *i=b+1;i<e;i++)
+            for(Agent *j=i;j>b && j[-1].id>j->id;j--) swap(j[-1],*j);
+        for(Agent *i=b;i<e;i++) depositTerrain<Walls>(i->x,i->y,deposit_amount);
+    });
+    depositFood();
+}
+
+// diffuse() and evaporate() in bands of rows
+template<bool Walls>
+void diffuseTiled(){
+    trailTmp.resize(trail.size());
+    const float decay = 1.0f-evaporation;
+    vector<int> tasks;
+    for(int b=0;b<(int)fieldCost.size();b++){
+        tasks.push_back(b);
+        if(fieldCost[b]<=0) fieldCost[b] = 1;
+    }
+    runTasks(tasks,fieldCost,[&](int b){
+        int y0 = b*SCHED_TILE, y1 = min(y0+SCHED_TILE,GRID_H);
+        for(int y=y0;y<y1;y++){
+            const trail_t *tc = &trail[idx(0,y)];
+            trail_t *out = &trailTmp[idx(0,y)];
+            if(y==0 || y==GRID_H-1)
+                for(int x=0;x<GRID_W;x++) out[x] = tscale(tc[x],decay);
+            else diffuseRow<Walls,true>(tc-GRID_W,tc,tc+GRID_W,&maze[idx(0,y-1)],&maze[idx(0,y)],&maze[idx(0,y+1)],out,decay);
+        }
+    });
+    trail.swap(trailTmp);
+}
+
+// ---------- Step ----------
+double agentSeconds = 0, fieldSeconds = 0;
+
+void step(){
+    applyWallEdits();
+    auto t0 = std::chrono::high_resolution_clock::now();
+    if(step_threads>0){
+        if(openMap) updateAgentsTiled<false>();
+        else updateAgentsTiled<true>();
+    } else updateAgents();
+    auto t1 = std::chrono::high_resolution_clock::now();
+    if(step_threads>0){
+        if(openMap) diffuseTiled<false>();
+        else diffuseTiled<true>();
+    } else {
+        diffuse();
+        evaporate();
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    agentSeconds += std::chrono::duration<double>(t1-t0).count();
+    fieldSeconds += std::chrono::duration<double>(t2-t1).count();
+    stepCount++;
+    checkConvergence();
+    applyDueEvents();
+    adaptPopulation();
+}
+
+// up to field_block steps with one blocked field pass (see Temporal
+// blocking), ending on the next convergence check or at step `last`
+void stepBlocked(long last){
+    applyWallEdits();
+    int T=min((long)field_block,min(conv_interval-stepCount%conv_interval,last-stepCount));
+    if(T<=0) return;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    fieldLog.clear();
+    fieldLogStart.assign(T+1,0);
+    for(int t=0;t<T;t++){
+        if(openMap) moveAgentsOn(LogLayer<false>());
+        else moveAgentsOn(LogLayer<true>());
+        for(auto &p:points){
+            size_t i=idx(p.x,p.y);
+            if(p.y>=ROW0 && p.y<ROW1 && maze[i]!=WALL) fieldLog.push_back({i,10.0f*p.weight});
+        }
+        fieldLogStart[t+1]=fieldLog.size();
+        stepCount++;
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    if(openMap) fieldBlock<false>(T);
+    else fieldBlock<true>(T);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    agentSeconds += std::chrono::duration<double>(t1-t0).count();
+    fieldSeconds += std::chrono::duration<double>(t2-t1).count();
+    checkConvergence();
+    applyDueEvents();
+    adaptPopulation();
+}
+
+// back to step 0 on the loaded map, before agents and points are placed again
+void resetRun(){
+    stepCount = 0;
+    converged = false;
+    stableRuns = 0;
+    anchorSize = anchorStep = convStart = 0;
+    coldSteps = -1;
+    coldRun = true;
+    convergedOnce = false;
+    warmStarted = false;
+    convX0 = convY0 = 0; convX1 = convY1 = 1<<30;
+    convAvg.clear(); convMask.clear();
+    events.clear(); nextEvent = 0;
+    nextPointId = 0;
+    agentSeconds = fieldSeconds = 0;
+    fast_trig = false;
+}
+
+// ---------- Display ----------
+// trail greyscale, walls blue
+inline void shadeCell(float v,float w,float maxTrail,unsigned char *px){
+    float g = (v>LOD_VISIBLE) ? min(v/maxTrail,1.0f)*(1-w) : 0;
+    px[0]=px[1]=(unsigned char)(255*g);
+    px[2]=(unsigned char)(255*(g+w));
+}
+
+#ifndef ADRP_LIB
+GLuint fieldTex = 0;
+vector<unsigned char> fieldPixels;
+
+// Trail and walls of the visible region, one texel per cell of the pyramid
+// level that matches the window resolution
+void drawField(float vx0,float vy0,float vx1,float vy1,float maxTrail){
+    int l=0;
+    while(l+1<(int)lod.size() && ((vx1-vx0)/(1<<l)>winW || (vy1-vy0)/(1<<l)>winH)) l++;
+    const LodLevel &lv=lod[l];
+    int cx0=max((int)floor(vx0)>>l,0), cx1=min(((int)ceil(vx1)+(1<<l)-1)>>l,lv.w);
+    int cy0=max((int)floor(vy0)>>l,0), cy1=min(((int)ceil(vy1)+(1<<l)-1)>>l,lv.h);
+    int tw=cx1-cx0, th=cy1-cy0;
+    if(tw<=0 || th<=0) return;
+
+    fieldPixels.resize(tw*th*4);
+    for(int y=0;y<th;y++)
+        for(int x=0;x<tw;x++){
+            int c=(cy0+y)*lv.w+cx0+x;
+            float v = l ? lv.trail[c] : tload(trail[c]);
+            float w = l ? lv.wall[c]/255.0f : (maze[c]==WALL);
+            unsigned char *px=&fieldPixels[(y*tw+x)*4];
+            shadeCell(v,w,maxTrail,px);
+            px[3]=255;
+        }
+
+    if(!fieldTex){
+        glGenTextures(1,&fieldTex);
+        glBindTexture(GL_TEXTURE_2D,fieldTex);
+        glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+    }
+    glBindTexture(GL_TEXTURE_2D,fieldTex);
+    glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA,tw,th,0,GL_RGBA,GL_UNSIGNED_BYTE,fieldPixels.data());
+
+    float qx0=cx0<<l, qx1=cx1<<l, qy0=cy0<<l, qy1=cy1<<l;
+    glEnable(GL_TEXTURE_2D);
+    glColor3f(1,1,1);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0,0); glVertex2f(qx0,qy0);
+    glTexCoord2f(1,0); glVertex2f(qx1,qy0);
+    glTexCoord2f(1,1); glVertex2f(qx1,qy1);
+    glTexCoord2f(0,1); glVertex2f(qx0,qy1);
+    glEnd();
+    glDisable(GL_TEXTURE_2D);
+}
+
+void display(){
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    step();
+    updateLod();
+
+    float maxTrail=lod.size()>1 ? lod.back().trail[0] : tload(trail[0]);
+    if(maxTrail<1e-5) maxTrail=1;
+
+    // draw in grid coordinates; the projection selects the visible region
+    float vx0,vy0,vx1,vy1;
+    viewRect(vx0,vy0,vx1,vy1);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(vx0,vx1,vy0,vy1,-1,1);
+    glMatrixMode(GL_MODELVIEW);
+
+    drawField(vx0,vy0,vx1,vy1,maxTrail);
+
+    glBegin(GL_POINTS);
+
+    // Agents (colored by local demand)
+    for(auto &a:agents){
+        if(a.x<vx0 || a.x>vx1 || a.y<vy0 || a.y>vy1) continue;
+        float v=sampleTrail(a.x,a.y);
+        float c=v/maxTrail;
+        glColor3f(c,0.2f,1.0f-c); // heat-style
+        glVertex2f(a.x,a.y);
+    }
+
+    // Food (emergencies)
+    for(auto &p:points){
+        glColor3f(1,0,0);
+        glVertex2f(p.x,p.y);
+    }
+
+    glEnd();
+
+    glutSwapBuffers();
+    glutPostRedisplay();
+
+    cnt++;
+
+    auto now = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = now - last;
+
+    if (elapsed.count() >= 1.0){
+        cout << cnt / elapsed.count() << " FPS" << endl;
+        cnt = 0;
+        last = now;
+    }
+}
+#endif
+
+// ---------- Frame export ----------
+// --frames <out> renders headless runs with the colours of display(): the
+// field comes from the largest pyramid level no wider than --frame-width,
+// agents and food are 2x2 pixel points on top. An <out> containing '%'
+// (e.g. frames/f%05d.png) is a printf pattern for a PNG sequence; any
+// other name gets raw rgb24 video, one frame after another (the size is
+// printed for ffmpeg -f rawvideo). The simulation only renders; frames
+// are queued to --encoders threads that compress and write them, and it
+// waits only when FRAME_QUEUE frames per encoder are still pending.
+
+// PNG with the Up filter and an RLE-only deflate stream (fixed Huffman
+// codes, matches at distance 1): black and flat regions collapse to a few
+// bits per run, and it needs nothing beyond this file.
+uint32_t crcTable[256];
+
+void initCrc(){
+    for(uint32_t n=0;n<256;n++){
+        uint32_t c=n;
+        for(int k=0;k<8;k++) c=(c&1) ? 0xedb88320u^(c>>1) : c>>1;
+        crcTable[n]=c;
+    }
+}
+
+struct BitWriter {
+    vector<unsigned char> &out;
+    uint32_t acc=0;
+    int n=0;
+    BitWriter(vector<unsigned char> &o):out(o){}
+    void put(uint32_t v,int bits){          // LSB first
+        acc|=v<<n; n+=bits;
+        while(n>=8){ out.push_back(acc&255); acc>>=8; n-=8; }
+    }
+    void code(uint32_t c,int len){          // Huffman codes go MSB first
+        uint32_t r=0;
+        for(int i=0;i<len;i++) r|=((c>>i)&1)<<(len-1-i);
+        put(r,len);
+    }
+    void flush(){ if(n>0) out.push_back(acc&255); acc=0; n=0; }
+};
+
+void putLiteral(BitWriter &bw,int v){
+    if(v<144) bw.code(0x30+v,8);
+    else if(v<256) bw.code(0x190+v-144,9);
+    else if(v<280) bw.code(v-256,7);
+    else bw.code(0xc0+v-280,8);
+}
+
+void putRun(BitWriter &bw,int len){         // 3..258 bytes, distance 1
+    static const int base[29]={3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,
+                               35,43,51,59,67,83,99,115,131,163,195,227,258};
+    static const int extra[29]={0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,
+                                3,3,3,3,4,4,4,4,5,5,5,5,0};
+    int k=28;
+    while(base[k]>len) k--;
+    putLiteral(bw,257+k);
+    bw.put(len-base[k],extra[k]);
+    bw.code(0,5);
+}
+
+void putChunk(vector<unsigned char> &png,const char *type,const vector<unsigned char> &data){
+    uint32_t n=data.size();
+    unsigned char len[4]={(unsigned char)(n>>24),(unsigned char)(n>>16),(unsigned char)(n>>8),(unsigned char)n};
+    png.insert(png.end(),len,len+4);
+    size_t start=png.size();
+    png.insert(png.end(),type,type+4);
+    png.insert(png.end(),data.begin(),data.end());
+    uint32_t c=0xffffffffu;
+    for(size_t i=start;i<png.size();i++) c=crcTable[(c^png[i])&255]^(c>>8);
+    c^=0xffffffffu;
+    unsigned char crc[4]={(unsigned char)(c>>24),(unsigned char)(c>>16),(unsigned char)(c>>8),(unsigned char)c};
+    png.insert(png.end(),crc,crc+4);
+}
+
+vector<unsigned char> encodePng(const vector<unsigned char> &rgb,int w,int h){
+    size_t stride=(size_t)w*3;
+    vector<unsigned char> raw((stride+1)*h);
+    for(int y=0;y<h;y++){
+        unsigned char *r=&raw[y*(stride+1)];
+        const unsigned char *cur=&rgb[y*stride], *up=y ? cur-stride : nullptr;
+        r[0]=2;                              // Up
+        for(size_t x=0;x<stride;x++) r[1+x]=cur[x]-(up ? up[x] : 0);
+    }
+
+    vector<unsigned char> z={0x78,0x01};
+    BitWriter bw(z);
+    bw.put(1,1); bw.put(1,2);                // final block, fixed codes
+    size_t i=0;
+    if(!raw.empty()){ putLiteral(bw,raw[0]); i=1; }
+    while(i<raw.size()){
+        size_t run=0;
+        while(i+run<raw.size() && run<258 && raw[i+run]==raw[i-1]) run++;
+        if(run>=3){ putRun(bw,run); i+=run; }
+        else putLiteral(bw,raw[i++]);
+    }
+    putLiteral(bw,256);
+    bw.flush();
+    uint32_t a=1, b=0;
+    for(unsigned char v:raw){ a=(a+v)%65521; b=(b+a)%65521; }
+    uint32_t adler=(b<<16)|a;
+    for(int k=3;k>=0;k--) z.push_back((adler>>(8*k))&255);
+
+    static const unsigned char sig[8]={137,'P','N','G',13,10,26,10};
+    vector<unsigned char> png(sig,sig+8);
+    vector<unsigned char> ihdr={(unsigned char)(w>>24),(unsigned char)(w>>16),(unsigned char)(w>>8),(unsigned char)w,
+                                (unsigned char)(h>>24),(unsigned char)(h>>16),(unsigned char)(h>>8),(unsigned char)h,
+                                8,2,0,0,0};  // 8-bit RGB
+    putChunk(png,"IHDR",ihdr);
+    putChunk(png,"IDAT",z);
+    putChunk(png,"IEND",{});
+    return png;
+}
+
+const int FRAME_QUEUE = 2;
+
+struct Frame {
+    long n;
+    vector<unsigned char> rgb;
+};
+
+string framePattern;
+int frameEvery = 1, frameWidth = 1<<30, frameEncoders = 0;
+int frameLevel = 0, frameW = 0, frameH = 0;
+long framesQueued = 0;
+double frameWaitSeconds = 0, frameRenderSeconds = 0;
+bool framePng = false, frameFailed = false;
+string framePrefix, frameSuffix;   // PNG names: prefix, frame number, suffix
+int frameDigits = 0;
+bool frameZeroPad = false;
+FILE *frameVideo = nullptr;
+deque<Frame> frameQueue;
+vector<Frame> frameFree;   // buffers handed back by the encoders
+mutex frameMutex;
+condition_variable frameReady, frameDone;
+vector<thread> frameThreads;
+bool frameStop = false;
+
+void encodeFrames(){
+    unique_lock<mutex> lk(frameMutex);
+    for(;;){
+        frameReady.wait(lk,[]{ return frameStop || !frameQueue.empty(); });
+        if(frameQueue.empty()) return;
+        Frame f=move(frameQueue.front());
+        frameQueue.pop_front();
+        lk.unlock();
+        bool ok;
+        if(framePng){
+            char num[32];
+            snprintf(num,sizeof num,frameZeroPad ? "%0*ld" : "%*ld",frameDigits,f.n);
+            string name=framePrefix+num+frameSuffix;
+            vector<unsigned char> png=encodePng(f.rgb,frameW,frameH);
+            FILE *out=fopen(name.c_str(),"wb");
+            ok=out && fwrite(png.data(),1,png.size(),out)==png.size();
+            if(out) fclose(out);
+        } else {
+            ok=fwrite(f.rgb.data(),1,f.rgb.size(),frameVideo)==f.rgb.size();
+        }
+        lk.lock();
+        if(!ok) frameFailed=true;
+        frameFree.push_back(move(f));
+        frameDone.notify_all();
+    }
+}
+
+// split a PNG pattern around its one %d, %Nd or %0Nd; the frame number is
+// formatted here, never by a format string taken from the command line
+bool parseFramePattern(){
+    size_t p=framePattern.find('%'), q=p+1, n=framePattern.size();
+    frameZeroPad = q<n && framePattern[q]=='0';
+    if(frameZeroPad) q++;
+    frameDigits = 0;
+    while(q<n && isdigit((unsigned char)framePattern[q]) && frameDigits<20)
+        frameDigits = frameDigits*10+(framePattern[q++]-'0');
+    if(q>=n || framePattern[q]!='d' || framePattern.find('%',q)!=string::npos) return false;
+    framePrefix = framePattern.substr(0,p);
+    frameSuffix = framePattern.substr(q+1);
+    return true;
+}
+
+bool startFrames(){
+    framePng = framePattern.find('%')!=string::npos;
+    if(framePng && !parseFramePattern()){
+        cout<<"--frames pattern needs exactly one %d, %Nd or %0Nd: "<<framePattern<<"\n";
+        return false;
+    }
+    if(!framePng){
+        frameVideo = fopen(framePattern.c_str(),"wb");
+        if(!frameVideo){ cout<<"Failed to write "<<framePattern<<"\n"; return false; }
+        frameEncoders = 1;   // raw frames are written in order by one thread
+    } else if(frameEncoders<=0)
+        frameEncoders = max(1,(int)thread::hardware_concurrency()-1);
+    initCrc();
+    initLod();
+    frameLevel = 0;
+    while(frameLevel+1<(int)lod.size() && lod[frameLevel].w>frameWidth) frameLevel++;
+    frameW = lod[frameLevel].w;
+    frameH = lod[frameLevel].h;
+    for(int i=0;i<frameEncoders;i++) frameThreads.emplace_back(encodeFrames);
+    return true;
+}
+
+void plotPoint(vector<unsigned char> &rgb,float x,float y,float r,float g,float b){
+    int px=(int)x>>frameLevel, py=(int)y>>frameLevel;
+    for(int yy=py;yy<=py+1;yy++)
+        for(int xx=px;xx<=px+1;xx++){
+            if(xx<0 || xx>=frameW || yy<0 || yy>=frameH) continue;
+            unsigned char *c=&rgb[((size_t)(frameH-1-yy)*frameW+xx)*3];   // y up, as on screen
+            c[0]=(unsigned char)(255*min(max(r,0.0f),1.0f));
+            c[1]=(unsigned char)(255*min(max(g,0.0f),1.0f));
+            c[2]=(unsigned char)(255*min(max(b,0.0f),1.0f));
+        }
+}
+
+void renderFrame(vector<unsigned char> &rgb){
+    // full-resolution frames need only the maximum, not the whole pyramid
+    float maxTrail=0;
+    if(frameLevel){
+        updateLod();
+        maxTrail=lod.back().trail[0];
+    } else
+        for(trail_t v:trail) maxTrail=max(maxTrail,tload(v));
+    if(maxTrail<1e-5) maxTrail=1;
+    const LodLevel &lv=lod[frameLevel];
+    rgb.resize((size_t)frameW*frameH*3);
+    for(int y=0;y<frameH;y++){
+        unsigned char *row=&rgb[(size_t)(frameH-1-y)*frameW*3];
+        size_t c=(size_t)y*frameW;
+        if(frameLevel)
+            for(int x=0;x<frameW;x++) shadeCell(lv.trail[c+x],lv.wall[c+x]/255.0f,maxTrail,row+3*x);
+        else
+            for(int x=0;x<frameW;x++) shadeCell(tload(trail[c+x]),maze[c+x]==WALL,maxTrail,row+3*x);
+    }
+    for(auto &a:agents){
+        float c=sampleTrail(a.x,a.y)/maxTrail;
+        plotPoint(rgb,a.x,a.y,c,0.2f,1.0f-c);
+    }
+    for(auto &p:points) plotPoint(rgb,p.x,p.y,1,0,0);
+}
+
+// render the current step if it is due and queue it for the encoders
+void captureFrame(){
+    if(framePattern.empty() || stepCount%frameEvery) return;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    Frame f;
+    {
+        unique_lock<mutex> lk(frameMutex);
+        frameDone.wait(lk,[]{ return frameQueue.size()<(size_t)FRAME_QUEUE*frameEncoders; });
+        if(!frameFree.empty()){ f=move(frameFree.back()); frameFree.pop_back(); }
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    f.n=framesQueued++;
+    renderFrame(f.rgb);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    {
+        lock_guard<mutex> lk(frameMutex);
+        frameQueue.push_back(move(f));
+    }
+    frameReady.notify_one();
+    frameWaitSeconds += std::chrono::duration<double>(t1-t0).count();
+    frameRenderSeconds += std::chrono::duration<double>(t2-t1).count();
+}
+
+// wait for the encoders to drain the queue; false if a frame failed to write
+bool finishFrames(){
+    {
+        lock_guard<mutex> lk(frameMutex);
+        frameStop=true;
+    }
+    frameReady.notify_all();
+    for(auto &t:frameThreads) t.join();
+    frameThreads.clear();
+    if(frameVideo) fclose(frameVideo);
+    frameVideo=nullptr;
+    if(frameFailed) cout<<"Failed to write some frames to "<<framePattern<<"\n";
+    return !frameFailed;
+}
+
+// ---------- Workers ----------
+// --workers N splits the grid into N horizontal strips, each run by a forked
+// process that stores only its own rows plus `halo` rows on either side.
+// One step of a worker: refresh the halo (the trail its agents can sense),
+// sense and move, hand agents that crossed the strip edge to the neighbour,
+// deposit, refresh the one row diffusion reads across the edge, diffuse and
+// evaporate. Workers talk to their two neighbours and, at the end, to the
+// parent, through a Transport: blocking point-to-point byte streams over
+// Unix sockets or shared memory. Neighbours exchange in two phases (pairs
+// 0-1, 2-3, ... then 1-2, 3-4, ...) with the lower rank sending first, so
+// no pair waits on a third process or on a full buffer.
+#ifndef _WIN32
+struct Transport {
+    virtual void send(int to,const void* buf,size_t n)=0;
+    virtual void recv(int from,void* buf,size_t n)=0;
+    virtual void keep(int self){}   // drop the channels of other processes
+    virtual ~Transport(){}
+};
+
+int numWorkers = 0;
+int workerRank = -1;        // numWorkers in the parent
+pid_t parentPid = 0;
+int stripY0 = 0, stripY1 = 0, halo = 0;
+Transport* net = nullptr;
+
+// processes 0..n-2 are workers, n-1 the parent; a channel links each
+// worker to the next one and to the parent
+inline bool linked(int a,int b,int n){
+    if(a>b) swap(a,b);
+    return a!=b && (b==a+1 || b==n-1);
+}
+
+// CPUs of each NUMA node that has any, from sysfs
+vector<cpu_set_t> numaNodes(){
+    vector<cpu_set_t> nodes;
+    for(int k=0;k<64;k++){
+        ifstream in("/sys/devices/system/node/node"+to_string(k)+"/cpulist");
+        string list, part;
+        if(!getline(in,list)) continue;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        stringstream ss(list);
+        while(getline(ss,part,',')){
+            int a,b;
+            int got = sscanf(part.c_str(),"%d-%d",&a,&b);
+            if(got<1) continue;
+            if(got==1) b=a;
+            for(int c=a;c<=b && c<CPU_SETSIZE;c++) CPU_SET(c,&set);
+        }
+        if(CPU_COUNT(&set)) nodes.push_back(set);
+    }
+    return nodes;
+}
+
+bool numaPin = false;   // --numa: worker r runs on node r*nodes/n
+
+void peerLost(){
+    cerr<<"worker "<<workerRank<<": peer process exited\n";
+    _exit(1);
+}
+
+struct SocketTransport : Transport {
+    int n;
+    vector<int> fd;   // fd[a*n+b]: a's end of the a-b socket
+    SocketTransport(int procs) : n(procs), fd(procs*procs,-1) {
+        for(int a=0;a<n;a++)
+            for(int b=a+1;b<n;b++){
+                int sv[2];
+                if(!linked(a,b,n)) continue;
+                if(socketpair(AF_UNIX,SOCK_STREAM,0,sv)){ perror("socketpair"); exit(1); }
+                fd[a*n+b]=sv[0]; fd[b*n+a]=sv[1];
+            }
+    }
+    void keep(int self) override {
+        for(int a=0;a<n;a++)
+            for(int b=0;b<n;b++)
+                if(a!=self && fd[a*n+b]>=0){ close(fd[a*n+b]); fd[a*n+b]=-1; }
+    }
+    void send(int to,const void* buf,size_t len) override {
+        const char* p=(const char*)buf;
+        while(len){
+            ssize_t k=write(fd[workerRank*n+to],p,len);
+            if(k<0 && errno==EINTR) continue;
+            if(k<=0) peerLost();
+            p+=k; len-=k;
+        }
+    }
+    void recv(int from,void* buf,size_t len) override {
+        char* p=(char*)buf;
+        while(len){
+            ssize_t k=read(fd[workerRank*n+from],p,len);
+            if(k<0 && errno==EINTR) continue;
+            if(k<=0) peerLost();
+            p+=k; len-=k;
+        }
+    }
+};
+
+// One single-slot mailbox per direction in a shared anonymous mapping;
+// a message larger than the slot goes through in several fills.
+struct ShmTransport : Transport {
+    static constexpr size_t SLOT = 1<<20;
+    struct Mailbox {
+        atomic<uint64_t> filled, drained;
+        size_t len;
+        char data[SLOT];
+    };
+    int n;
+    vector<int> slot;   // slot[from*n+to]
+    Mailbox* box;
+    ShmTransport(int procs) : n(procs), slot(procs*procs,-1) {
+        int count=0;
+        for(int a=0;a<n;a++)
+            for(int b=0;b<n;b++)
+                if(linked(a,b,n)) slot[a*n+b]=count++;
+        void* m=mmap(nullptr,count*sizeof(Mailbox),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+        if(m==MAP_FAILED){ perror("mmap"); exit(1); }
+        box=(Mailbox*)m;
+        for(int i=0;i<count;i++){ new(&box[i].filled) atomic<uint64_t>(0); new(&box[i].drained) atomic<uint64_t>(0); }
+    }
+    // one core may run every process, so waiting always yields
+    void idle(unsigned &spins){
+        if(++spins%4096==0){
+            int st;
+            if(workerRank<numWorkers ? getppid()!=parentPid
+               : waitpid(-1,&st,WNOHANG)>0 && !(WIFEXITED(st) && WEXITSTATUS(st)==0))
+                peerLost();
+        }
+        sched_yield();
+    }
+    void send(int to,const void* buf,size_t len) override {
+        Mailbox &m=box[slot[workerRank*n+to]];
+        const char* p=(const char*)buf;
+        unsigned spins=0;
+        while(len){
+            while(m.filled.load(memory_order_acquire)!=m.drained.load(memory_order_acquire)) idle(spins);
+            m.len=min(len,SLOT);
+            memcpy(m.data,p,m.len);
+            p+=m.len; len-=m.len;
+            m.filled.fetch_add(1,memory_order_release);
+        }
+    }
+    void recv(int from,void* buf,size_t len) override {
+        Mailbox &m=box[slot[from*n+workerRank]];
+        char* p=(char*)buf;
+        unsigned spins=0;
+        while(len){
+            while(m.filled.load(memory_order_acquire)==m.drained.load(memory_order_acquire)) idle(spins);
+            memcpy(p,m.data,m.len);
+            p+=m.len; len-=m.len;
+            m.drained.fetch_add(1,memory_order_release);
+        }
+    }
+};
+
+// call f(peer) for each neighbour in the deadlock-free phase order
+template<class F> void forNeighbours(F f){
+    for(int phase=0;phase<2;phase++){
+        if(workerRank+1<numWorkers && workerRank%2==phase) f(workerRank+1);
+        if(workerRank>0 && (workerRank-1)%2==phase) f(workerRank-1);
+    }
+}
+
+// send our edge rows to each neighbour and take theirs into our halo
+void exchangeHalo(int depth){
+    size_t bytes=(size_t)depth*GRID_W*sizeof(trail_t);
+    forNeighbours([&](int peer){
+        bool below = peer>workerRank;   // peer holds the larger rows
+        trail_t *out = &trail[idx(0, below ? stripY1-depth : stripY0)];
+        trail_t *in  = &trail[idx(0, below ? stripY1 : stripY0-depth)];
+        if(workerRank<peer){ net->send(peer,out,bytes); net->recv(peer,in,bytes); }
+        else { net->recv(peer,in,bytes); net->send(peer,out,bytes); }
+    });
+}
+
+AgentVec leaving[2], arriving;
+
+// agents move under one cell per step, so they only ever cross into a
+// neighbouring strip; the merge keeps the local array sorted by id
+void migrateAgents(){
+    leaving[0].clear(); leaving[1].clear(); arriving.clear();
+    size_t k=0;
+    for(auto &a:agents){
+        int y=(int)a.y;
+        if(y<stripY0) leaving[0].push_back(a);
+        else if(y>=stripY1) leaving[1].push_back(a);
+        else agents[k++]=a;
+    }
+    agents.resize(k);
+
+    forNeighbours([&](int peer){
+        AgentVec &out = leaving[peer>workerRank];
+        auto give=[&]{
+            uint64_t n=out.size();
+            net->send(peer,&n,sizeof n);
+            net->send(peer,out.data(),n*sizeof(Agent));
+        };
+        auto take=[&]{
+            uint64_t n;
+            net->recv(peer,&n,sizeof n);
+            size_t o=arriving.size();
+            arriving.resize(o+n);
+            net->recv(peer,arriving.data()+o,n*sizeof(Agent));
+        };
+        if(workerRank<peer){ give(); take(); }
+        else { take(); give(); }
+    });
+
+    if(arriving.empty()) return;
+    auto byId=[](const Agent &a,const Agent &b){ return a.id<b.id; };
+    sort(arriving.begin(),arriving.end(),byId);
+    agents.insert(agents.end(),arriving.begin(),arriving.end());
+    inplace_merge(agents.begin(),agents.begin()+k,agents.end(),byId);
+}
+
+struct WorkerStats {
+    uint64_t agents;
+    double compute, exchange;
+};
+
+void runWorker(long steps){
+    stripY0 = (long)GRID_H*workerRank/numWorkers;
+    stripY1 = (long)GRID_H*(workerRank+1)/numWorkers;
+    int r0=max(0,stripY0-halo), r1=min(GRID_H,stripY1+halo);
+    maze.keep((size_t)r0*GRID_W,(size_t)r1*GRID_W);
+    trail.keep((size_t)r0*GRID_W,(size_t)r1*GRID_W);
+    trailTmp.view(nullptr,0);
+    ROW0 = r0; ROW1 = r1;
+    size_t k=0;
+    for(auto &a:agents)
+        if((int)a.y>=stripY0 && (int)a.y<stripY1) agents[k++]=a;
+    agents.resize(k);
+    agents.shrink_to_fit();
+    snapPoints = false;
+    if(workerRank>0) cout.setstate(ios::badbit);   // event messages once
+
+    WorkerStats st = {0,0,0};
+    typedef std::chrono::high_resolution_clock clk;
+    while(stepCount<steps){
+        auto t0=clk::now();
+        exchangeHalo(halo);
+        auto t1=clk::now();
+        moveAgents();
+        auto t2=clk::now();
+        migrateAgents();
+        auto t3=clk::now();
+        depositAgents();
+        depositFood();
+        auto t4=clk::now();
+        exchangeHalo(1);
+        auto t5=clk::now();
+        diffuse();
+        evaporate();
+        auto t6=clk::now();
+        st.exchange += std::chrono::duration<double>((t1-t0)+(t3-t2)+(t5-t4)).count();
+        st.compute  += std::chrono::duration<double>((t2-t1)+(t4-t3)+(t6-t5)).count();
+        stepCount++;
+        applyDueEvents();
+    }
+
+    st.agents = agents.size();
+    net->send(numWorkers,&st,sizeof st);
+    net->send(numWorkers,&trail[idx(0,stripY0)],(size_t)(stripY1-stripY0)*GRID_W*sizeof(trail_t));
+}
+
+// fork the workers, wait for their rows and leave the assembled trail in
+// the parent; false if the grid cannot be split that finely
+bool runWorkers(int n,bool shm,long steps){
+    halo = (int)ceil(sensor_distance)+2;
+    if(GRID_H/n < halo){
+        cout<<"Strips of "<<GRID_H/n<<" rows are narrower than the "<<halo
+            <<"-row halo, use at most "<<GRID_H/halo<<" workers\n";
+        return false;
+    }
+
+    // snap event positions while the whole maze is at hand
+    for(size_t i=nextEvent;i<events.size();){
+        PointEvent &e=events[i];
+        int xi=(int)e.x, yi=(int)e.y;
+        if(e.type==EV_ADD || e.type==EV_MOVE){
+            if(!nearestFree(xi,yi)){
+                cout<<"No free cell near ("<<e.x<<","<<e.y<<"), step "<<e.step<<" event dropped\n";
+                events.erase(events.begin()+i);
+                continue;
+            }
+            e.x=xi; e.y=yi;
+        }
+        i++;
+    }
+
+    vector<cpu_set_t> nodes;
+    if(numaPin) nodes = numaNodes();
+    auto nodeOf = [&](int r){ return (int)((size_t)r*nodes.size()/n); };
+
+    numWorkers = n;
+    net = shm ? (Transport*)new ShmTransport(n+1) : (Transport*)new SocketTransport(n+1);
+    parentPid = getpid();
+    cout.flush();
+    for(int r=0;r<n;r++){
+        pid_t pid=fork();
+        if(pid<0){ perror("fork"); exit(1); }
+        if(pid==0){
+            workerRank = r;
+            // pin before runWorker allocates the strip, so first touch is local
+            if(!nodes.empty()) sched_setaffinity(0,sizeof(cpu_set_t),&nodes[nodeOf(r)]);
+            net->keep(r);
+            runWorker(steps);
+            cout.flush();
+            _exit(0);
+        }
+    }
+    workerRank = n;
+    net->keep(n);
+
+    for(int r=0;r<n;r++){
+        WorkerStats st;
+        int y0=(long)GRID_H*r/n, y1=(long)GRID_H*(r+1)/n;
+        net->recv(r,&st,sizeof st);
+        net->recv(r,&trail[idx(0,y0)],(size_t)(y1-y0)*GRID_W*sizeof(trail_t));
+        cout<<"worker "<<r<<": rows "<<y0<<"-"<<y1-1<<", "<<st.agents<<" agents, compute "
+            <<1e3*st.compute/max(steps,1L)<<" ms/step, exchange "
+            <<1e3*st.exchange/max(steps,1L)<<" ms/step";
+        if(!nodes.empty()) cout<<", node "<<nodeOf(r);
+        cout<<"\n";
+    }
+    int status;
+    while(wait(&status)>0) {}
+    stepCount = steps;
+    return true;
+}
+#endif
+
+// ---------- Grid files ----------
+// Maps too big for RAM run from a grid file: a header page, the maze bytes
+// and two trail layers (current and diffusion target), row-major and
+// memory-mapped. A step is the --sync step done band by band, a band being
+// a run of full rows: sense and move against each band plus its sensing
+// halo, hand agents to their new band, deposit per band, then diffuse and
+// evaporate per band. Touching rows pages them in; once the resident bands
+// pass the --budget the least recently used are dropped from memory (the
+// file keeps their data), so peak RSS follows the budget, not the map
+// size. The trail equals that of a --sync run of the same map in RAM.
+#ifndef _WIN32
+struct GridHeader {
+    char magic[8];        // "ADRPGRID"
+    uint32_t version;
+    uint32_t cellBytes;   // sizeof(trail_t) of the build that wrote it
+    uint32_t width, height;
+    uint32_t current;     // trail layer holding the latest trail
+    uint64_t steps;       // steps simulated into that trail so far
+};
+
+const size_t GRID_PAGE = 4096;
+const size_t GRID_BAND_CELLS = 1<<20;
+
+GridHeader* grid = nullptr;
+char* gridBase = nullptr;
+size_t gridBytes = 0, gridMazeOff = 0, gridTrailOff[2];
+int bandRows = 0, numBands = 0;
+size_t gridBudget = 0;
+vector<uint64_t> bandUsed;   // last use, 0 = not resident
+uint64_t bandClock = 0;
+int residentBands = 0;
+vector<AgentVec> bandAgents;
+
+inline size_t pageUp(size_t n){ return (n+GRID_PAGE-1)/GRID_PAGE*GRID_PAGE; }
+inline size_t bandBytes(){ return (size_t)bandRows*GRID_W*(1+2*sizeof(trail_t)); }
+
+void gridLayout(int w,int h){
+    size_t cells=(size_t)w*h;
+    gridMazeOff = GRID_PAGE;
+    gridTrailOff[0] = gridMazeOff + pageUp(cells);
+    gridTrailOff[1] = gridTrailOff[0] + pageUp(cells*sizeof(trail_t));
+    gridBytes = gridTrailOff[1] + pageUp(cells*sizeof(trail_t));
+}
+
+// drop the whole pages of bytes [off,off+len) from memory
+void dropPages(size_t off,size_t len){
+    size_t a=pageUp(off), b=(off+len)/GRID_PAGE*GRID_PAGE;
+    if(b>a) madvise(gridBase+a,b-a,MADV_DONTNEED);
+}
+
+void evictBand(int b){
+    size_t w=GRID_W, y0=(size_t)b*bandRows, rows=min(bandRows,GRID_H-(int)y0);
+    dropPages(gridMazeOff+y0*w,rows*w);
+    for(int l=0;l<2;l++)
+        dropPages(gridTrailOff[l]+y0*w*sizeof(trail_t),rows*w*sizeof(trail_t));
+    bandUsed[b]=0;
+    residentBands--;
+}
+
+// rows [y0,y1) are about to be used: mark their bands and page out the
+// least recently used other bands until the budget holds
+void pageRows(int y0,int y1){
+    if(!grid) return;
+    int b0=y0/bandRows, b1=(y1-1)/bandRows;
+    for(int b=b0;b<=b1;b++){
+        if(!bandUsed[b]) residentBands++;
+        bandUsed[b]=++bandClock;
+    }
+    while((size_t)residentBands*bandBytes()>gridBudget){
+        int lru=-1;
+        for(int b=0;b<numBands;b++)
+            if(bandUsed[b] && (b<b0||b>b1) && (lru<0||bandUsed[b]<bandUsed[lru])) lru=b;
+        if(lru<0) break;
+        evictBand(lru);
+    }
+}
+
+void pageOutAll(){
+    madvise(gridBase,gridBytes,MADV_DONTNEED);
+    bandUsed.assign(numBands,0);
+    residentBands=0;
+}
+
+// point maze, trail and trailTmp at rows [r0,r1) of the file
+void gridWindow(int r0,int r1){
+    size_t w=GRID_W, cells=(size_t)(r1-r0)*w;
+    ROW0=r0; ROW1=r1;
+    maze.view((unsigned char*)(gridBase+gridMazeOff)+r0*w,cells);
+    trail.view((trail_t*)(gridBase+gridTrailOff[grid->current])+r0*w,cells);
+    trailTmp.view((trail_t*)(gridBase+gridTrailOff[grid->current^1])+r0*w,cells);
+}
+
+bool openGrid(const char* file,size_t budget){
+    int fd=open(file,O_RDWR);
+    if(fd<0){ perror(file); return false; }
+    GridHeader h;
+    struct stat st;
+    if(pread(fd,&h,sizeof h,0)!=(ssize_t)sizeof h || memcmp(h.magic,"ADRPGRID",8) || h.version!=1){
+        cout<<file<<": not a grid file\n";
+        close(fd);
+        return false;
+    }
+    if(h.cellBytes!=sizeof(trail_t)){
+        cout<<file<<": trail has "<<h.cellBytes<<"-byte cells, this build uses "<<sizeof(trail_t)<<"\n";
+        close(fd);
+        return false;
+    }
+    gridLayout(h.width,h.height);
+    if(fstat(fd,&st) || (size_t)st.st_size<gridBytes){
+        cout<<file<<": truncated\n";
+        close(fd);
+        return false;
+    }
+    void* m=mmap(nullptr,gridBytes,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+    if(m==MAP_FAILED){ perror("mmap"); return false; }
+
+    gridBase=(char*)m;
+    grid=(GridHeader*)m;
+    GRID_W=h.width;
+    GRID_H=h.height;
+    buildTerrainLUT();
+    halo=(int)ceil(sensor_distance)+2;
+    bandRows=min(max((int)(GRID_BAND_CELLS/GRID_W),halo),GRID_H);
+    numBands=(GRID_H+bandRows-1)/bandRows;
+    bandUsed.assign(numBands,0);
+    bandAgents.assign(numBands,AgentVec());
+    // a band's sensing window spans up to three bands, plus one to page in
+    gridBudget=max(budget,4*bandBytes());
+    gridWindow(0,GRID_H);
+    cout<<file<<": "<<GRID_W<<"x"<<GRID_H<<", "<<numBands<<" bands of "<<bandRows
+        <<" rows, budget "<<(gridBudget>>20)<<" MB\n";
+    if(grid->steps) cout<<"continuing from the trail of "<<grid->steps<<" earlier steps\n";
+    return true;
+}
+
+// next header number of a PGM file, skipping blanks and comments; the one
+// blank that ends the header is consumed with the last number
+bool pgmInt(FILE* f,int &v){
+    int c=fgetc(f);
+    while(c=='#' || isspace(c)){
+        if(c=='#') while(c!='\n' && c!=EOF) c=fgetc(f);
+        c=fgetc(f);
+    }
+    if(!isdigit(c)) return false;
+    for(v=0;isdigit(c);c=fgetc(f)) v=v*10+(c-'0');
+    return true;
+}
+
+// Binary 8-bit PGM is streamed a row at a time; other formats are decoded
+// whole by stb_image first.
+struct RasterRows {
+    FILE* f = nullptr;
+    unsigned char* img = nullptr;
+    int w=0, h=0, y=0;
+
+    bool open(const char* file){
+        int maxval, n;
+        f=fopen(file,"rb");
+        if(f && fgetc(f)=='P' && fgetc(f)=='5' && pgmInt(f,w) && pgmInt(f,h)
+           && pgmInt(f,maxval) && maxval<256)
+            return true;
+        if(f) fclose(f);
+        f=nullptr;
+        img=stbi_load(file,&w,&h,&n,1);
+        return img!=nullptr;
+    }
+    bool next(unsigned char* row){
+        if(y>=h) return false;
+        if(f && fread(row,1,w,f)!=(size_t)w) return false;
+        if(img) memcpy(row,img+(size_t)y*w,w);
+        y++;
+        return true;
+    }
+    ~RasterRows(){
+        if(f) fclose(f);
+        if(img) stbi_image_free(img);
+    }
+};
+
+// convert a map (and optional speed raster) into a grid file with an
+// empty trail, one row in memory at a time
+bool writeGrid(const char* mapFile,const char* terrainFile,bool useTerrain,const char* out){
+    RasterRows map, cost;
+    if(!map.open(mapFile)){
+        cout<<"Failed to load map\n";
+        return false;
+    }
+    bool costFromMap = !terrainFile;
+    if(terrainFile && (!cost.open(terrainFile) || cost.w!=map.w || cost.h!=map.h)){
+        cout<<"Terrain map missing or not "<<map.w<<"x"<<map.h<<", using map grey levels\n";
+        costFromMap = true;
+    }
+
+    int fd=open(out,O_RDWR|O_CREAT|O_TRUNC,0644);
+    gridLayout(map.w,map.h);
+    if(fd<0 || ftruncate(fd,gridBytes)){   // the trail layers stay sparse zeros
+        perror(out);
+        if(fd>=0) close(fd);
+        return false;
+    }
+    vector<unsigned char> grey(map.w), costGrey(map.w), cells(map.w);
+    for(int y=0;y<map.h;y++){
+        if(!map.next(grey.data()) || (!costFromMap && !cost.next(costGrey.data()))){
+            cout<<"Unexpected end of map data at row "<<y<<"\n";
+            close(fd);
+            return false;
+        }
+        for(int x=0;x<map.w;x++)
+            cells[x]=mazeByte(grey[x],costFromMap ? grey[x] : costGrey[x],costFromMap,useTerrain);
+        if(pwrite(fd,cells.data(),map.w,gridMazeOff+(size_t)y*map.w)!=map.w){
+            perror(out);
+            close(fd);
+            return false;
+        }
+    }
+    // the header goes last, so an interrupted conversion is not a grid file
+    GridHeader h;
+    memset(&h,0,sizeof h);
+    memcpy(h.magic,"ADRPGRID",8);
+    h.version=1;
+    h.cellBytes=sizeof(trail_t);
+    h.width=map.w;
+    h.height=map.h;
+    bool ok = pwrite(fd,&h,sizeof h,0)==(ssize_t)sizeof h;
+    close(fd);
+    if(ok) cout<<"Wrote "<<out<<": "<<map.w<<"x"<<map.h<<", "<<(gridBytes>>20)<<" MB\n";
+    return ok;
+}
+
+// placing agents probes random maze cells, each fault maps a few pages
+// around the cell, so page out every few agents
+void initGridAgents(){
+    agents.resize(NUM_AGENTS);
+    for(size_t i=0;i<agents.size();i+=64){
+        placeAgents(i,min(i+64,agents.size()));
+        pageOutAll();
+    }
+}
+
+bool pointInRows(int y0,int y1){
+    for(auto &p:points) if(p.y>=y0 && p.y<y1) return true;
+    return false;
+}
+
+void stepGrid(){
+    // sense and move against the trail as it was at the start of the step
+    for(int b=0;b<numBands;b++){
+        if(bandAgents[b].empty()) continue;
+        int y0=b*bandRows, y1=min(y0+bandRows,GRID_H);
+        int r0=max(0,y0-halo), r1=min(GRID_H,y1+halo);
+        pageRows(r0,r1);
+        gridWindow(r0,r1);
+        agents.swap(bandAgents[b]);
+        moveAgents();
+        agents.swap(bandAgents[b]);
+    }
+
+    // hand agents that left their band to the new one, keeping id order
+    arriving.clear();
+    for(int b=0;b<numBands;b++){
+        auto &v=bandAgents[b];
+        size_t k=0;
+        for(auto &a:v){
+            if((int)a.y/bandRows!=b) arriving.push_back(a);
+            else v[k++]=a;
+        }
+        v.resize(k);
+    }
+    auto byBandId=[](const Agent &a,const Agent &b){
+        int ba=(int)a.y/bandRows, bb=(int)b.y/bandRows;
+        return ba!=bb ? ba<bb : a.id<b.id;
+    };
+    sort(arriving.begin(),arriving.end(),byBandId);
+    for(size_t i=0,j;i<arriving.size();i=j){
+        int b=(int)arriving[i].y/bandRows;
+        for(j=i;j<arriving.size() && (int)arriving[j].y/bandRows==b;j++) {}
+        auto &v=bandAgents[b];
+        size_t k=v.size();
+        v.insert(v.end(),arriving.begin()+i,arriving.begin()+j);
+        inplace_merge(v.begin(),v.begin()+k,v.end(),byBandId);
+    }
+
+    // deposit; the window is the band alone so food is added once
+    for(int b=0;b<numBands;b++){
+        int y0=b*bandRows, y1=min(y0+bandRows,GRID_H);
+        if(bandAgents[b].empty() && !pointInRows(y0,y1)) continue;
+        pageRows(y0,y1);
+        gridWindow(y0,y1);
+        agents.swap(bandAgents[b]);
+        depositAgents();
+        depositFood();
+        agents.swap(bandAgents[b]);
+    }
+
+    // diffuse into the other layer and evaporate there
+    for(int b=0;b<numBands;b++){
+        int y0=b*bandRows, y1=min(y0+bandRows,GRID_H);
+        pageRows(max(0,y0-1),min(GRID_H,y1+1));
+        gridWindow(max(0,y0-1),min(GRID_H,y1+1));
+        if(y0==0) copy(&trail[idx(0,0)],&trail[idx(0,1)],&trailTmp[idx(0,0)]);
+        if(y1==GRID_H) copy(&trail[idx(0,GRID_H-1)],&trail[idx(0,GRID_H-1)]+GRID_W,&trailTmp[idx(0,GRID_H-1)]);
+        diffuseRows(max(y0,1),min(y1,GRID_H-1));
+        for(size_t i=idx(0,y0);i<idx(0,y1);i++)
+            trailTmp[i]=tscale(trailTmp[i],1.0f-evaporation);
+    }
+    grid->current^=1;
+    grid->steps++;
+
+    gridWindow(0,GRID_H);   // events and output see the whole grid
+    stepCount++;
+    applyDueEvents();
+}
+
+void runGrid(long steps){
+    for(auto &a:agents) bandAgents[(int)a.y/bandRows].push_back(a);
+    AgentVec().swap(agents);
+    while(stepCount<steps) stepGrid();
+    for(auto &v:bandAgents) agents.insert(agents.end(),v.begin(),v.end());
+}
+
+long peakRssKB(){
+    struct rusage ru;
+    getrusage(RUSAGE_SELF,&ru);
+    return ru.ru_maxrss;
+}
+#else
+inline void pageRows(int,int){}
+#endif
+
+// ---------- Output ----------
+// "TRAIL <w> <h>\n" followed by w*h little-endian float32 values, whatever
+// the storage type, so runs of different builds can be compared directly
+template<class F>
+bool dumpCells(const char* filename,F value){
+    ofstream out(filename,ios::binary);
+    if(!out){
+        cout<<"Failed to write "<<filename<<"\n";
+        return false;
+    }
+    out<<"TRAIL "<<GRID_W<<" "<<GRID_H<<"\n";
+    vector<float> row(GRID_W);
+    for(int y=0;y<GRID_H;y++){
+        pageRows(y,y+1);
+        for(int x=0;x<GRID_W;x++) row[x]=value(x,y);
+        out.write((const char*)row.data(),row.size()*sizeof(float));
+    }
+    return true;
+}
+
+bool dumpTrail(const char* filename){
+    return dumpCells(filename,[](int x,int y){ return tload(trail[idx(x,y)]); });
+}
+
+// ---------- Ensemble ----------
+// --ensemble R runs R replicas on the same map and demand points, replica r
+// placing its agents with seed+r and drawing from its own rng stream. The
+// replicas' trails are interleaved per cell, etrail[cell*R + r], so the
+// diffusion sweep reads the walls and builds the neighbour list of a cell
+// once, then updates all R replicas in one contiguous (vectorized) loop.
+// At the end a replica's network is its cells above conv_threshold times
+// its mean free-cell trail, and --prob-map writes for every cell the
+// fraction of replicas whose network contains it.
+int channels = 0;   // interleaved trail channels: replicas, or species
+vector<trail_t,SimAlloc<trail_t>> etrail, etrailTmp;
+vector<AgentVec> replicaAgents;
+vector<mt19937> replicaRng;
+
+template<bool Walls>
+struct ReplicaLayer {
+    static constexpr bool walls = Walls;
+    int r;
+    float sample(float x,float y) const {
+        int xi=(int)x, yi=(int)y;
+        if(xi<0||xi>=GRID_W||yi<ROW0||yi>=ROW1) return 0;
+        size_t i=idx(xi,yi);
+        if(Walls && maze[i]==WALL) return 0;
+        return tload(etrail[i*channels+r]);
+    }
+    void depositAgent(float x,float y,float amt) const {
+        int xi=(int)x, yi=(int)y;
+        if(xi<0||xi>=GRID_W||yi<ROW0||yi>=ROW1) return;
+        size_t i=idx(xi,yi);
+        tadd(etrail[i*channels+r],Walls ? amt*terrainDeposit[maze[i]] : amt);
+    }
+};
+
+// Diffuse and evaporate in one sweep (diffuse() followed by evaporate()).
+// The walls are static here, so each free cell's neighbours are looked up
+// once: a byte with one bit per free neighbour, and per byte value the
+// weight of each neighbour. Per cell that leaves one byte load before the
+// channel loop, which vectorizes; N is the channel count when it is one of
+// the compiled sizes (no remainder loop), 0 otherwise.
+vector<unsigned char,SimAlloc<unsigned char>> ensembleMask;
+float ensembleWeight[256][8];
+
+void initEnsembleMasks(){
+    const int nb[8][2]={{-1,-1},{0,-1},{1,-1},{-1,0},{1,0},{-1,1},{0,1},{1,1}};
+    ensembleMask.assign((size_t)GRID_W*GRID_H,0);
+    for(int y=1;y<GRID_H-1;y++)
+        for(int x=1;x<GRID_W-1;x++)
+            for(int k=0;k<8;k++)
+                if(maze[idx(x+nb[k][0],y+nb[k][1])]!=WALL) ensembleMask[idx(x,y)]|=1<<k;
+    for(int m=0;m<256;m++){
+        int n=1+__builtin_popcount(m);   // the cell itself is free
+        for(int k=0;k<8;k++) ensembleWeight[m][k]=((m>>k)&1)*diffusion_rate/n;
+    }
+}
+
+template<int N>
+void diffuseEnsembleN(){
+    const int R = N ? N : channels;
+    const float keep=1-diffusion_rate, decay=1.0f-evaporation;
+    etrailTmp.resize(etrail.size(),tstore(0.0f));
+    const ptrdiff_t W=GRID_W;
+    const ptrdiff_t off[8]={(-W-1)*R,-W*R,(-W+1)*R,-R,R,(W-1)*R,W*R,(W+1)*R};
+    for(int y=0;y<GRID_H;y++)
+        for(int x=0;x<GRID_W;x++){
+            size_t i=idx(x,y);
+            // nothing deposits into walls, so they stay 0 in both buffers
+            if(maze[i]==WALL) continue;
+            const trail_t *tc=&etrail[i*R];
+            trail_t *out=&etrailTmp[i*R];
+            if(x==0 || y==0 || x==GRID_W-1 || y==GRID_H-1){
+                for(int r=0;r<R;r++) out[r]=tscale(tc[r],decay);
+                continue;
+            }
+            const float *c=ensembleWeight[ensembleMask[i]];
+            float cw=diffusion_rate/(1+__builtin_popcount(ensembleMask[i]));
+            for(int r=0;r<R;r++){
+                float s=tload(tc[r])*(keep+cw);
+                for(int k=0;k<8;k++) s+=c[k]*tload(tc[off[k]+r]);
+                out[r]=tscale(tstore(s),decay);
+            }
+        }
+    etrail.swap(etrailTmp);
+}
+
+void diffuseEnsemble(){
+    switch(channels){
+        case 2:  diffuseEnsembleN<2>();  break;
+        case 3:  diffuseEnsembleN<3>();  break;
+        case 4:  diffuseEnsembleN<4>();  break;
+        case 8:  diffuseEnsembleN<8>();  break;
+        case 16: diffuseEnsembleN<16>(); break;
+        case 32: diffuseEnsembleN<32>(); break;
+        case 64: diffuseEnsembleN<64>(); break;
+        default: diffuseEnsembleN<0>();
+    }
+}
+
+void initEnsemble(int R,unsigned seed){
+    size_t cells=(size_t)GRID_W*GRID_H;
+    channels=R;
+    trail.assign(cells,tstore(0.0f));
+    assignPoints();
+    etrail.assign(cells*R,tstore(0.0f));
+    for(auto &p:points){
+        size_t i=idx(p.x,p.y);
+        fill(&etrail[i*R],&etrail[i*R]+R,trail[i]);
+    }
+    trail.view(nullptr,0);
+    initEnsembleMasks();
+
+    replicaAgents.resize(R);
+    replicaRng.resize(R);
+    for(int r=0;r<R;r++){
+        srand(seed+r);
+        rng.seed(seed+r);
+        agents.resize(NUM_AGENTS);
+        placeAgents(0,agents.size());
+        replicaAgents[r].swap(agents);
+        replicaRng[r]=rng;
+    }
+}
+
+// An agent reads R times more trail bytes per cell than in a single run,
+// so every ENSEMBLE_SORT steps each replica's agents are put in tile order
+// to keep consecutive agents on the same cache lines.
+const int ENSEMBLE_SORT = 32;
+
+void sortAgentsByTile(AgentVec &v){
+    auto key=[](const Agent &a){ return ((int)a.y>>4)*((GRID_W>>4)+1)+((int)a.x>>4); };
+    sort(v.begin(),v.end(),[&](const Agent &a,const Agent &b){ return key(a)<key(b); });
+}
+
+void stepEnsemble(){
+    auto t0 = std::chrono::high_resolution_clock::now();
+    if(stepCount%ENSEMBLE_SORT==0)
+        for(auto &v:replicaAgents) sortAgentsByTile(v);
+    for(int r=0;r<channels;r++){
+        agents.swap(replicaAgents[r]);
+        swap(rng,replicaRng[r]);
+        if(openMap) moveAgentsOn(ReplicaLayer<false>{r});
+        else moveAgentsOn(ReplicaLayer<true>{r});
+        for(auto &p:points){
+            size_t i=idx(p.x,p.y);
+            if(maze[i]!=WALL) tadd(etrail[i*channels+r],10.0f*p.weight);
+        }
+        swap(rng,replicaRng[r]);
+        agents.swap(replicaAgents[r]);
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    diffuseEnsemble();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    agentSeconds += std::chrono::duration<double>(t1-t0).count();
+    fieldSeconds += std::chrono::duration<double>(t2-t1).count();
+    stepCount++;
+}
+
+// per channel, the network threshold: conv_threshold times its mean free-cell trail
+vector<float> channelThresholds(){
+    const int R=channels;
+    size_t cells=(size_t)GRID_W*GRID_H;
+    vector<double> sum(R,0.0);
+    long freeCells=0;
+    for(size_t i=0;i<cells;i++){
+        if(maze[i]==WALL) continue;
+        freeCells++;
+        for(int r=0;r<R;r++) sum[r]+=tload(etrail[i*R+r]);
+    }
+    vector<float> thr(R);
+    for(int r=0;r<R;r++) thr[r]=conv_threshold*sum[r]/max(freeCells,1L);
+    return thr;
+}
+
+// fraction of replicas whose network contains each cell
+vector<float> networkProbability(){
+    const int R=channels;
+    size_t cells=(size_t)GRID_W*GRID_H;
+    vector<float> thr=channelThresholds(), prob(cells,0.0f);
+    for(size_t i=0;i<cells;i++){
+        if(maze[i]==WALL) continue;
+        int on=0;
+        for(int r=0;r<R;r++) on+=(tload(etrail[i*R+r])>thr[r]);
+        prob[i]=(float)on/R;
+    }
+    return prob;
+}
+
+// ---------- Species ----------
+// --species <file> runs K agent species on the same map and demand points,
+// one line of the file per species:
+//   agents sensor_distance sensor_angle turn_angle deposit w_0 ... w_K-1
+// A species deposits into its own trail channel and senses the weighted sum
+// of all K channels, w_j < 0 repelling it from species j. The channels use
+// the ensemble's interleaved storage, etrail[cell*K + s]: one diffusion
+// sweep updates all of them, and one sensor sample reads the K channels of
+// a cell from a single cache line. Food is deposited into every channel.
+// Walls and cells off the grid sense as -FLT_MAX, below any weighted sum,
+// so a repelling trail never makes them look better.
+struct Species {
+    int agents;
+    float sensorDistance, sensorAngle, turnAngle, deposit;
+    vector<float> weight;
+};
+
+vector<Species> species;
+vector<AgentVec> speciesAgents;
+
+bool loadSpecies(const char* filename){
+    ifstream in(filename);
+    if(!in){
+        cout<<"Failed to open species file "<<filename<<"\n";
+        return false;
+    }
+    string line;
+    vector<int> lineNos;
+    int lineNo=0;
+    while(getline(in,line)){
+        lineNo++;
+        istringstream ls(line.substr(0,line.find('#')));
+        Species sp;
+        if(!(ls>>sp.agents)) continue;
+        if(!(ls>>sp.sensorDistance>>sp.sensorAngle>>sp.turnAngle>>sp.deposit) || sp.agents<0){
+            cout<<filename<<":"<<lineNo<<": bad species\n";
+            return false;
+        }
+        float w;
+        while(ls>>w) sp.weight.push_back(w);
+        species.push_back(sp);
+        lineNos.push_back(lineNo);
+    }
+    for(size_t s=0;s<species.size();s++)
+        if(species[s].weight.size()!=species.size()){
+            cout<<filename<<":"<<lineNos[s]<<": needs "<<species.size()<<" channel weights\n";
+            return false;
+        }
+    if(species.empty()) cout<<filename<<": no species\n";
+    return !species.empty();
+}
+
+template<bool Walls,int K>
+struct SpeciesLayer {
+    static constexpr bool walls = Walls;
+    int s;
+    const float *w;
+    float sample(float x,float y) const {
+        const int C = K ? K : channels;
+        int xi=(int)x, yi=(int)y;
+        if(xi<0||xi>=GRID_W||yi<ROW0||yi>=ROW1) return -FLT_MAX;
+        size_t i=idx(xi,yi);
+        if(Walls && maze[i]==WALL) return -FLT_MAX;
+        const trail_t *t=&etrail[i*C];
+        float v=0;
+        for(int k=0;k<C;k++) v+=w[k]*tload(t[k]);
+        return v;
+    }
+    void depositAgent(float x,float y,float amt) const {
+        int xi=(int)x, yi=(int)y;
+        if(xi<0||xi>=GRID_W||yi<ROW0||yi>=ROW1) return;
+        size_t i=idx(xi,yi);
+        tadd(etrail[i*(K ? K : channels)+s],Walls ? amt*terrainDeposit[maze[i]] : amt);
+    }
+};
+
+void initSpecies(){
+    size_t cells=(size_t)GRID_W*GRID_H;
+    const int K=species.size();
+    channels=K;
+    trail.assign(cells,tstore(0.0f));
+    assignPoints();
+    etrail.assign(cells*K,tstore(0.0f));
+    for(auto &p:points){
+        size_t i=idx(p.x,p.y);
+        fill(&etrail[i*K],&etrail[i*K]+K,trail[i]);
+    }
+    trail.view(nullptr,0);
+    initEnsembleMasks();
+
+    speciesAgents.resize(K);
+    for(int s=0;s<K;s++){
+        agents.resize(species[s].agents);
+        placeAgents(0,agents.size());
+        speciesAgents[s].swap(agents);
+    }
+}
+
+template<int K>
+void moveSpecies(int s){
+    const float *w=species[s].weight.data();
+    if(openMap) moveAgentsOn(SpeciesLayer<false,K>{s,w});
+    else moveAgentsOn(SpeciesLayer<true,K>{s,w});
+}
+
+// Species take turns on the shared rng stream with their own parameters
+// swapped into the globals the agent kernels read.
+void stepSpecies(){
+    auto t0 = std::chrono::high_resolution_clock::now();
+    if(stepCount%ENSEMBLE_SORT==0)
+        for(auto &v:speciesAgents) sortAgentsByTile(v);
+    float sd=sensor_distance, sa=sensor_angle, ta=turn_angle, da=deposit_amount;
+    for(int s=0;s<channels;s++){
+        const Species &sp=species[s];
+        sensor_distance=sp.sensorDistance; sensor_angle=sp.sensorAngle;
+        turn_angle=sp.turnAngle; deposit_amount=sp.deposit;
+        agents.swap(speciesAgents[s]);
+        switch(channels){
+            case 2:  moveSpecies<2>(s); break;
+            case 3:  moveSpecies<3>(s); break;
+            case 4:  moveSpecies<4>(s); break;
+            default: moveSpecies<0>(s);
+        }
+        agents.swap(speciesAgents[s]);
+    }
+    sensor_distance=sd; sensor_angle=sa; turn_angle=ta; deposit_amount=da;
+    for(auto &p:points){
+        size_t i=idx(p.x,p.y);
+        if(maze[i]==WALL) continue;
+        for(int s=0;s<channels;s++) tadd(etrail[i*channels+s],10.0f*p.weight);
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    diffuseEnsemble();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    agentSeconds += std::chrono::duration<double>(t1-t0).count();
+    fieldSeconds += std::chrono::duration<double>(t2-t1).count();
+    stepCount++;
+}
+
+// ---------- Server ----------
+// --serve <socket> answers network queries on a local Unix socket, one
+// request per connection. A request is lines of text ending with "run":
+//
+//   map <path>             a map file the server can read, or
+//   map-data <bytes>       followed by that many bytes of an image file
+//   no-terrain             walls only, as --no-terrain
+//   point <x> <y> [w]      demand point (snapped to a free cell); without
+//                          any, NUM_POINTS random ones as usual
+//   seed <n>               default 1
+//   steps <n>              step limit, default 5000
+//   until converged|steps  stop at convergence (default) or run all steps
+//   set <param> <value>    one of serverParams below
+//   fast-trig, sync,       as the command line flags
+//   warm-start
+//   output trail|network
+//   run
+//
+// The reply is "map <w> <h> loaded|cached", "progress <step> <stable runs>"
+// at every convergence check, "done <step> converged|not-converged", then
+// the result: a trail dump as --dump-trail writes it, or "NETWORK <w> <h>\n"
+// and one byte per cell, 1 where the trail is above conv_threshold times the
+// mean free-cell trail. A bad request gets a single "error <message>" line.
+//
+// --pool n engine processes (default 2) accept on the same socket. Each
+// keeps its agent and trail buffers from one request to the next, and the
+// mazes of its last MAP_CACHE maps keyed by a hash of the map bytes, so a
+// repeated query on the same map neither decodes nor allocates.
+
+// engine parameters by name, also set through the library (see Library)
+struct ServerParam { const char* name; float* v; float def; };
+ServerParam serverParams[] = {
+    {"sensor_distance",&sensor_distance,0}, {"sensor_angle",&sensor_angle,0},
+    {"turn_angle",&turn_angle,0}, {"step_size",&step_size,0},
+    {"deposit_amount",&deposit_amount,0}, {"evaporation",&evaporation,0},
+    {"diffusion_rate",&diffusion_rate,0}, {"min_speed",&terrain_min_speed,0},
+    {"warm_level",&warm_level,0}, {"warm_potential",&warm_potential,0},
+    {"warm_length",&warm_length,0}, {"warm_agents",&warm_agents,0},
+};
+
+#ifndef _WIN32
+const int MAP_CACHE = 8;
+
+struct CachedMap {
+    uint64_t hash;
+    int w,h;
+    bool open;
+    Cells<unsigned char> maze;
+    long used;
+};
+
+vector<CachedMap> mapCache;
+long cacheClock = 0;
+vector<unsigned char> mapBytes;   // the request's map file, reused
+
+struct Request {
+    bool useTerrain = true, untilConverged = true;
+    bool fastTrig = false, sync = false, network = false, warm = false;
+    unsigned seed = 1;
+    long steps = 5000;
+    vector<Point> points;
+};
+
+uint64_t hashMap(const vector<unsigned char> &b,bool useTerrain){
+    uint64_t h = mix64(b.size()*2+useTerrain), w;
+    size_t i=0;
+    for(;i+8<=b.size();i+=8){ memcpy(&w,&b[i],8); h=mix64(h^w); }
+    w=0; memcpy(&w,b.data()+i,b.size()-i);
+    return mix64(h^w);
+}
+
+// point maze at the cached maze of these map bytes, decoding them on a miss
+bool useMap(const vector<unsigned char> &bytes,bool useTerrain,bool &hit){
+    uint64_t key = hashMap(bytes,useTerrain);
+    CachedMap* m = nullptr;
+    for(auto &c:mapCache) if(c.hash==key) m=&c;
+    hit = (m!=nullptr);
+    if(!m){
+        int w,h,n;
+        unsigned char* data = stbi_load_from_memory(bytes.data(),(int)bytes.size(),&w,&h,&n,1);
+        if(!data) return false;
+        buildMaze(data,data,w,h,useTerrain);
+        stbi_image_free(data);
+        if((int)mapCache.size()==MAP_CACHE)
+            mapCache.erase(min_element(mapCache.begin(),mapCache.end(),
+                [](const CachedMap &a,const CachedMap &b){ return a.used<b.used; }));
+        mapCache.push_back({key,w,h,openMap,{},0});
+        m = &mapCache.back();
+        m->maze.swap(maze);
+    }
+    m->used = ++cacheClock;
+    GRID_W = m->w; GRID_H = m->h;
+    ROW0 = 0; ROW1 = GRID_H;
+    openMap = m->open;
+    maze.view(m->maze.begin(),m->maze.size());
+    buildTerrainLUT();
+    return true;
+}
+
+bool readMapFile(const string &path,vector<unsigned char> &b){
+    FILE* f = fopen(path.c_str(),"rb");
+    if(!f) return false;
+    fseek(f,0,SEEK_END);
+    long n = ftell(f);
+    fseek(f,0,SEEK_SET);
+    b.resize(max(n,0L));
+    bool ok = n>0 && fread(b.data(),1,n,f)==(size_t)n;
+    fclose(f);
+    return ok;
+}
+
+bool readRequest(FILE* in,Request &q,string &err){
+    for(auto &p:serverParams) *p.v = p.def;
+    mapBytes.clear();
+    char buf[512];
+    while(fgets(buf,sizeof buf,in)){
+        istringstream ss(buf);
+        string cmd, arg;
+        ss>>cmd;
+        if(cmd=="run"){
+            if(mapBytes.empty()){ err="no map"; return false; }
+            return true;
+        }
+        else if(cmd=="map"){
+            ss>>arg;
+            if(!readMapFile(arg,mapBytes)){ err="cannot read "+arg; return false; }
+        }
+        else if(cmd=="map-data"){
+            long n=0;
+            ss>>n;
+            if(n<=0 || n>(1L<<30)){ err="bad map-data size"; return false; }
+            mapBytes.resize(n);
+            if(fread(mapBytes.data(),1,n,in)!=(size_t)n){ err="short map-data"; return false; }
+        }
+        else if(cmd=="no-terrain") q.useTerrain = false;
+        else if(cmd=="point"){
+            Point p;
+            p.weight = 1.0f;
+            if(!(ss>>p.x>>p.y)){ err="bad point"; return false; }
+            string w, extra;
+            if(ss>>w){
+                char* end;
+                p.weight = strtof(w.c_str(),&end);
+                if(*end || ss>>extra){ err="bad point"; return false; }
+            }
+            q.points.push_back(p);
+        }
+        else if(cmd=="seed") ss>>q.seed;
+        else if(cmd=="steps") ss>>q.steps;
+        else if(cmd=="until"){ ss>>arg; q.untilConverged = (arg!="steps"); }
+        else if(cmd=="set"){
+            float v;
+            ss>>arg>>v;
+            ServerParam* p = nullptr;
+            for(auto &s:serverParams) if(arg==s.name) p=&s;
+            if(!p || !ss){ err="bad parameter "+arg; return false; }
+            *p->v = v;
+        }
+        else if(cmd=="fast-trig") q.fastTrig = true;
+        else if(cmd=="sync") q.sync = true;
+        else if(cmd=="warm-start") q.warm = true;
+        else if(cmd=="output"){ ss>>arg; q.network = (arg=="network"); }
+        else if(!cmd.empty()){ err="unknown command "+cmd; return false; }
+    }
+    err = "request ended before run";
+    return false;
+}
+
+bool sendAll(int fd,const void* buf,size_t len){
+    const char* p=(const char*)buf;
+    while(len){
+        ssize_t k=::send(fd,p,len,MSG_NOSIGNAL);
+        if(k<0 && errno==EINTR) continue;
+        if(k<=0) return false;
+        p+=k; len-=k;
+    }
+    return true;
+}
+
+bool sendLine(int fd,const string &s){
+    string l = s+"\n";
+    return sendAll(fd,l.data(),l.size());
+}
+
+// one request on an accepted connection, answered on the same fd
+void serveRequest(int fd){
+    FILE* in = fdopen(fd,"r");
+    Request q;
+    string err;
+    bool hit;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    if(!readRequest(in,q,err)){ sendLine(fd,"error "+err); fclose(in); return; }
+    if(!useMap(mapBytes,q.useTerrain,hit)){ sendLine(fd,"error cannot decode map"); fclose(in); return; }
+    sendLine(fd,"map "+to_string(GRID_W)+" "+to_string(GRID_H)+(hit?" cached":" loaded"));
+
+    resetRun();
+    srand(q.seed);
+    rng.seed(q.seed);
+    sync_seed = q.seed;
+    sync_update = q.sync;
+    initAgents();
+    if(q.points.empty()){
+        points.assign(NUM_POINTS,Point());
+        assignPoints();
+    } else {
+        points.clear();
+        for(auto &p:q.points)
+            if(addPoint(p.x,p.y,p.weight)<0){
+                sendLine(fd,"error no free cell near "+to_string((int)p.x)+" "+to_string((int)p.y));
+                fclose(in);
+                return;
+            }
+    }
+    if(q.warm) warmStart();
+    setFastTrig(q.fastTrig);
+
+    bool live = true;
+    while(live && stepCount<q.steps && !(q.untilConverged && converged)){
+        step();
+        if(stepCount%conv_interval==0)
+            live = sendLine(fd,"progress "+to_string(stepCount)+" "+to_string(stableRuns));
+    }
+    live = live && sendLine(fd,"done "+to_string(stepCount)+(converged?" converged":" not-converged"));
+
+    if(live && q.network){
+        double sum=0; long freeCells=0;
+        for(size_t i=0;i<trail.size();i++)
+            if(maze[i]!=WALL){ sum+=tload(trail[i]); freeCells++; }
+        float thr = conv_threshold*sum/max(freeCells,1L);
+        vector<unsigned char> row(GRID_W);
+        live = sendLine(fd,"NETWORK "+to_string(GRID_W)+" "+to_string(GRID_H));
+        for(int y=0;live && y<GRID_H;y++){
+            for(int x=0;x<GRID_W;x++) row[x] = maze[idx(x,y)]!=WALL && tload(trail[idx(x,y)])>thr;
+            live = sendAll(fd,row.data(),row.size());
+        }
+    } else if(live){
+        vector<float> row(GRID_W);
+        live = sendLine(fd,"TRAIL "+to_string(GRID_W)+" "+to_string(GRID_H));
+        for(int y=0;live && y<GRID_H;y++){
+            for(int x=0;x<GRID_W;x++) row[x] = tload(trail[idx(x,y)]);
+            live = sendAll(fd,row.data(),row.size()*sizeof(float));
+        }
+    }
+    fclose(in);
+
+    std::chrono::duration<double> el = std::chrono::high_resolution_clock::now()-t0;
+    cout<<"engine "<<getpid()<<": "<<GRID_W<<"x"<<GRID_H<<" map ("<<(hit?"cached":"loaded")<<"), "
+        <<stepCount<<" steps, "<<(converged?"converged":"not converged")<<", "<<el.count()<<" s"
+        <<(live?"":", client gone")<<endl;
+}
+
+bool serve(const char* path,int pool){
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if(strlen(path)>=sizeof addr.sun_path){ cout<<"socket path too long\n"; return false; }
+    strcpy(addr.sun_path,path);
+    struct stat st;
+    if(stat(path,&st)==0 && S_ISSOCK(st.st_mode)) unlink(path);   // stale socket
+
+    int lfd = socket(AF_UNIX,SOCK_STREAM,0);
+    mode_t mask = umask(077);   // owner only
+    int rc = bind(lfd,(sockaddr*)&addr,sizeof addr);
+    umask(mask);
+    if(lfd<0 || rc || listen(lfd,64)){ perror(path); return false; }
+    for(auto &p:serverParams) p.def = *p.v;
+    cout<<"serving on "<<path<<" with "<<pool<<" engines"<<endl;
+
+    auto spawn = [&](){
+        pid_t pid = fork();
+        if(pid!=0) return;
+        for(;;){
+            int fd = accept(lfd,nullptr,nullptr);
+            if(fd>=0) serveRequest(fd);
+            else if(errno!=EINTR && errno!=ECONNABORTED){ perror("accept"); _exit(1); }
+        }
+    };
+    for(int i=0;i<pool;i++) spawn();
+    for(;;){
+        int status;
+        pid_t pid = wait(&status);
+        if(pid<0){
+            if(errno==EINTR) continue;
+            return false;
+        }
+        cout<<"engine "<<pid<<" exited, starting another"<<endl;
+        sleep(1);
+        spawn();
+    }
+}
+#endif
+
+// ---------- Library ----------
+// Built with -shared -DADRP_LIB the engine is a library without the window
+// (slime.py wraps it for Python). The state is the same globals the program
+// uses, so there is one engine per process; run sweeps in several
+// processes. The array getters return the engine's own memory, for
+// zero-copy views: the trail buffer alternates between two allocations as
+// diffusion swaps them, so trail, agent and point pointers hold only until
+// the next call that steps or edits the engine.
+#ifdef ADRP_LIB
+#ifdef _WIN32
+#define ADRP_API extern "C" __declspec(dllexport)
+#else
+#define ADRP_API extern "C" __attribute__((visibility("default")))
+#endif
+
+// 1 if the map loaded; the engine then needs adrp_reset()
+ADRP_API int adrp_load_map(const char* file,const char* terrain,int useTerrain){
+    return loadMap(file,terrain,useTerrain!=0);
+}
+
+// step 0 with NUM_AGENTS fresh agents, and NUM_POINTS random points or none
+ADRP_API void adrp_reset(unsigned seed,int randomPoints){
+    resetRun();
+    srand(seed);
+    rng.seed(seed);
+    sync_seed = seed;
+    initAgents();
+    points.assign(randomPoints ? NUM_POINTS : 0,Point());
+    assignPoints();
+}
+
+// run up to n steps, fewer if stopAtConvergence and the network converges;
+// returns the steps run
+ADRP_API long adrp_step(long n,int stopAtConvergence){
+    long start = stepCount;
+    while(stepCount-start<n && !(stopAtConvergence && converged)) step();
+    return stepCount-start;
+}
+
+ADRP_API int adrp_set(const char* name,float value){
+    for(auto &p:serverParams)
+        if(!strcmp(name,p.name)){ *p.v = value; return 1; }
+    if(!strcmp(name,"fast_trig")){ setFastTrig(value!=0); return 1; }
+    return 0;
+}
+
+ADRP_API int adrp_add_point(float x,float y,float w){ return addPoint(x,y,w); }
+ADRP_API int adrp_move_point(int id,float x,float y){ return movePoint(id,x,y); }
+ADRP_API int adrp_remove_point(int id){ return removePoint(id); }
+ADRP_API int adrp_weight_point(int id,float w){ return reweightPoint(id,w); }
+// seed trail and agents from the current points, as --warm-start; call it
+// after adrp_reset() and the points are in place
+ADRP_API void adrp_warm_start(){ warmStart(); }
+
+ADRP_API int adrp_width(){ return GRID_W; }
+ADRP_API int adrp_height(){ return GRID_H; }
+ADRP_API long adrp_step_count(){ return stepCount; }
+ADRP_API int adrp_converged(){ return converged; }
+ADRP_API int adrp_agent_size(){ return sizeof(Agent); }
+ADRP_API int adrp_point_size(){ return sizeof(Point); }
+#ifdef TRAIL_FIXED16
+ADRP_API int adrp_trail_scale(){ return TRAIL_SCALE; }   // uint16 cells, value*scale
+#else
+ADRP_API int adrp_trail_scale(){ return 0; }             // float cells
+#endif
+
+ADRP_API trail_t* adrp_trail(){ return trail.begin(); }
+ADRP_API unsigned char* adrp_maze(){ return maze.begin(); }
+ADRP_API Agent* adrp_agents(long *count){ *count = agents.size(); return agents.data(); }
+ADRP_API Point* adrp_points(long *count){ *count = points.size(); return points.data(); }
+#endif
+
+// ---------- Main ----------
+#ifndef ADRP_LIB
+void usage(){
+    cout<<"usage: adrp [--map file] [--terrain file | --no-terrain] [--min-speed s]\n"
+          "            [--seed n] [--events file] [--event \"<step> <op> ...\"] [--headless steps]\n"
+          "            [--dump-trail file] [--fast-trig] [--sync]\n"
+          "            [--workers n [--transport socket|shm]]\n"
+          "            [--write-grid file] [--grid file [--budget MB]]\n"
+          "            [--ensemble replicas [--prob-map file]]\n"
+          "            [--serve socket [--pool n]] [--alloc default|huge|small] [--numa]\n"
+          "            [--adaptive] [--species file] [--warm-start]\n"
+          "            [--frames out [--frame-every n] [--frame-width w] [--encoders n]]\n"
+          "            [--field-block steps] [--sort-deposit [--deposit-threads n]] [--threads n]\n";
+}
+
+int main(int argc,char**argv){
+    const char* mapFile = "map.png";
+    const char* terrainFile = nullptr;
+    bool useTerrain = true;
+    long headlessSteps = -1;
+    const char* dumpFile = nullptr;
+    bool fastTrig = false;
+    bool warm = false;
+    int workers = 0;
+    bool shmTransport = false;
+    const char* gridFile = nullptr;
+    const char* writeGridFile = nullptr;
+    size_t budgetMB = 1024;
+    int ensemble = 0;
+    const char* probFile = nullptr;
+    const char* speciesFile = nullptr;
+    const char* servePath = nullptr;
+    bool numa = false;
+    int pool = 2;
+    int threads = 0;
+    unsigned seed = time(0);
+    vector<string> eventFiles, eventLines;
+
+    for(int i=1;i<argc;i++){
+        string a = argv[i];
+        bool hasVal = (i+1<argc);
+        if(a=="--map" && hasVal) mapFile = argv[++i];
+        else if(a=="--terrain" && hasVal) terrainFile = argv[++i];
+        else if(a=="--no-terrain") useTerrain = false;
+        else if(a=="--min-speed" && hasVal) terrain_min_speed = atof(argv[++i]);
+        else if(a=="--seed" && hasVal) seed = strtoul(argv[++i],0,10);
+        else if(a=="--events" && hasVal) eventFiles.push_back(argv[++i]);
+        else if(a=="--event" && hasVal) eventLines.push_back(argv[++i]);
+        else if(a=="--headless" && hasVal) headlessSteps = atol(argv[++i]);
+        else if(a=="--dump-trail" && hasVal) dumpFile = argv[++i];
+        else if(a=="--fast-trig") fastTrig = true;
+        else if(a=="--sync") sync_update = true;
+        else if(a=="--warm-start") warm = true;
+        else if(a=="--workers" && hasVal) workers = atoi(argv[++i]);
+        else if(a=="--transport" && hasVal){
+            string t = argv[++i];
+            if(t!="socket" && t!="shm"){ usage(); return 1; }
+            shmTransport = (t=="shm");
+        }
+        else if(a=="--grid" && hasVal) gridFile = argv[++i];
+        else if(a=="--write-grid" && hasVal) writeGridFile = argv[++i];
+        else if(a=="--budget" && hasVal) budgetMB = atol(argv[++i]);
+        else if(a=="--ensemble" && hasVal) ensemble = atoi(argv[++i]);
+        else if(a=="--prob-map" && hasVal) probFile = argv[++i];
+        else if(a=="--serve" && hasVal) servePath = argv[++i];
+        else if(a=="--pool" && hasVal) pool = max(1,atoi(argv[++i]));
+        else if(a=="--alloc" && hasVal){
+            string m = argv[++i];
+            if(m=="huge") allocMode = ALLOC_HUGE;
+            else if(m=="small") allocMode = ALLOC_SMALL;
+            else if(m!="default"){ usage(); return 1; }
+        }
+        else if(a=="--numa") numa = true;
+        else if(a=="--adaptive") adaptive = true;
+        else if(a=="--species" && hasVal) speciesFile = argv[++i];
+        else if(a=="--threads" && hasVal) threads = max(1,atoi(argv[++i]));
+        else if(a=="--sort-deposit") sort_deposit = true;
+        else if(a=="--deposit-threads" && hasVal){ deposit_threads = max(1,atoi(argv[++i])); sort_deposit = true; }
+        else if(a=="--field-block" && hasVal) field_block = max(1,atoi(argv[++i]));
+        else if(a=="--frames" && hasVal) framePattern = argv[++i];
+        else if(a=="--frame-every" && hasVal) frameEvery = max(1,atoi(argv[++i]));
+        else if(a=="--frame-width" && hasVal) frameWidth = max(1,atoi(argv[++i]));
+        else if(a=="--encoders" && hasVal) frameEncoders = atoi(argv[++i]);
+        else if(a=="--help"){ usage(); return 0; }
+        else { usage(); return 1; }
+    }
+
+    if(servePath){
+#ifndef _WIN32
+        return serve(servePath,pool) ? 0 : 1;
+#else
+        cout<<"--serve is not available on this platform\n";
+        return 1;
+#endif
+    }
+#ifndef _WIN32
+    if(writeGridFile) return writeGrid(mapFile,terrainFile,useTerrain,writeGridFile) ? 0 : 1;
+    if(gridFile){
+        if(headlessSteps<0 || workers>0){ cout<<"--grid needs --headless and no --workers\n"; return 1; }
+        if(!openGrid(gridFile,budgetMB<<20)) return 1;
+        sync_update = true;
+    } else
+#endif
+    loadMap(mapFile,terrainFile,useTerrain);
+    if(maze.empty()) return 1;
+    srand(seed);
+    rng.seed(seed);
+    sync_seed = seed;
+
+    if(workers>0){
+        if(headlessSteps<0){ cout<<"--workers needs --headless\n"; return 1; }
+        sync_update = true;
+    }
+    if(threads>0){
+        if(workers>0 || gridFile || ensemble>0 || speciesFile || field_block>1 || sort_deposit){
+            cout<<"--threads replaces --workers, --grid, --ensemble, --species, --field-block and --sort-deposit\n";
+            return 1;
+        }
+        sync_update = true;
+    }
+    if(adaptive && (sync_update || gridFile || ensemble>0 || speciesFile)){
+        cout<<"--adaptive needs the default update: no --sync, --workers, --grid, --ensemble or --species\n";
+        return 1;
+    }
+    if(sort_deposit && !sync_update){
+        cout<<"--sort-deposit orders the deposit phase of --sync, --workers and --grid runs\n";
+        return 1;
+    }
+    if(field_block>1 && (headlessSteps<0 || sync_update || gridFile || ensemble>0 || speciesFile)){
+        cout<<"--field-block needs --headless and no --sync, --workers, --grid, --ensemble or --species\n";
+        return 1;
+    }
+    if(!framePattern.empty() && (headlessSteps<0 || workers>0 || gridFile || ensemble>0 || speciesFile)){
+        cout<<"--frames needs --headless and no --workers, --grid, --ensemble or --species\n";
+        return 1;
+    }
+    if(warm && (gridFile || ensemble>0 || speciesFile)){
+        cout<<"--warm-start needs a single run: no --grid, --ensemble or --species\n";
+        return 1;
+    }
+    if(threads>0) startScheduler(threads);
+    if(numa && workers==0){ cout<<"--numa needs --workers\n"; return 1; }
+#ifndef _WIN32
+    numaPin = numa;
+#endif
+
+    for(auto &f:eventFiles) loadEvents(f.c_str());
+    for(auto &l:eventLines){
+        PointEvent e;
+        if(parseEvent(l,e)) queueEvent(e);
+        else cout<<"bad event: "<<l<<"\n";
+    }
+
+    if(ensemble>0){
+        if(headlessSteps<0 || workers>0 || gridFile || sync_update || !events.empty()){
+            cout<<"--ensemble needs --headless and no --workers, --grid, --sync or events\n";
+            return 1;
+        }
+        initEnsemble(ensemble,seed);
+        setFastTrig(fastTrig);
+        auto t0 = std::chrono::high_resolution_clock::now();
+        while(stepCount<headlessSteps) stepEnsemble();
+        std::chrono::duration<double> el = std::chrono::high_resolution_clock::now()-t0;
+        cout<<ensemble<<" replicas, "<<stepCount<<" steps in "<<el.count()<<" s\n";
+        if(stepCount>0)
+            cout<<"agents: "<<1e3*agentSeconds/stepCount<<" ms/step, field: "
+                <<1e3*fieldSeconds/stepCount<<" ms/step, "
+                <<1e3*(agentSeconds+fieldSeconds)/stepCount/ensemble<<" ms/step per replica\n";
+        vector<float> prob = networkProbability();
+        long cells[3]={0,0,0};
+        double mean=0;
+        for(float p:prob){ mean+=p; cells[0]+=(p>0); cells[1]+=(p>=0.5f); cells[2]+=(p==1.0f); }
+        cout<<"network: "<<mean<<" cells per replica, "<<cells[0]<<" in any, "<<cells[1]
+            <<" in at least half, "<<cells[2]<<" in all replicas\n";
+        if(allocMode!=ALLOC_DEFAULT) cout<<"huge pages: "<<hugePagesKB()/1024<<" MB\n";
+        if(probFile) dumpCells(probFile,[&](int x,int y){ return prob[idx(x,y)]; });
+        return 0;
+    }
+
+    if(speciesFile){
+        if(headlessSteps<0 || workers>0 || gridFile || sync_update || ensemble>0 || !events.empty()){
+            cout<<"--species needs --headless and no --workers, --grid, --sync, --ensemble or events\n";
+            return 1;
+        }
+        if(!loadSpecies(speciesFile)) return 1;
+        initSpecies();
+        setFastTrig(fastTrig);
+        auto t0 = std::chrono::high_resolution_clock::now();
+        while(stepCount<headlessSteps) stepSpecies();
+        std::chrono::duration<double> el = std::chrono::high_resolution_clock::now()-t0;
+        cout<<channels<<" species, "<<stepCount<<" steps in "<<el.count()<<" s\n";
+        if(stepCount>0)
+            cout<<"agents: "<<1e3*agentSeconds/stepCount<<" ms/step, field: "
+                <<1e3*fieldSeconds/stepCount<<" ms/step\n";
+        vector<float> thr = channelThresholds();
+        size_t cells=(size_t)GRID_W*GRID_H;
+        vector<long> own(channels,0);
+        long shared=0;
+        for(size_t i=0;i<cells;i++){
+            if(maze[i]==WALL) continue;
+            int on=0;
+            for(int s=0;s<channels;s++)
+                if(tload(etrail[i*channels+s])>thr[s]){ own[s]++; on++; }
+            shared+=(on>1);
+        }
+        for(int s=0;s<channels;s++)
+            cout<<"species "<<s<<": "<<species[s].agents<<" agents, network "<<own[s]<<" cells\n";
+        cout<<shared<<" cells are in more than one species' network\n";
+        if(allocMode!=ALLOC_DEFAULT) cout<<"huge pages: "<<hugePagesKB()/1024<<" MB\n";
+        // one dump per species, <file>.<s>
+        if(dumpFile)
+            for(int s=0;s<channels;s++)
+                dumpCells((string(dumpFile)+"."+to_string(s)).c_str(),
+                          [&](int x,int y){ return tload(etrail[idx(x,y)*channels+s]); });
+        return 0;
+    }
+
+    if(headlessSteps>=0){
+#ifndef _WIN32
+        if(gridFile) initGridAgents();
+        else
+#endif
+        initAgents();
+        assignPoints();
+        applyDueEvents();   // step 0 events, part of the cold start
+        if(warm) warmStart();
+        setFastTrig(fastTrig);
+        auto t0 = std::chrono::high_resolution_clock::now();
+#ifndef _WIN32
+        if(gridFile){
+            runGrid(headlessSteps);
+            std::chrono::duration<double> el = std::chrono::high_resolution_clock::now()-t0;
+            cout<<stepCount<<" steps in "<<el.count()<<" s, peak RSS "<<peakRssKB()/1024<<" MB\n";
+            if(dumpFile) dumpTrail(dumpFile);
+            return 0;
+        }
+#endif
+        if(workers>0){
+#ifndef _WIN32
+            if(!runWorkers(workers,shmTransport,headlessSteps)) return 1;
+            std::chrono::duration<double> el = std::chrono::high_resolution_clock::now()-t0;
+            cout<<workers<<" workers ("<<(shmTransport?"shm":"socket")<<"): "
+                <<stepCount<<" steps in "<<el.count()<<" s\n";
+            if(dumpFile) dumpTrail(dumpFile);
+            return 0;
+#else
+            cout<<"--workers is not available on this platform\n";
+            return 1;
+#endif
+        }
+        if(!framePattern.empty() && !startFrames()) return 1;
+        double agentSum = 0;
+        while(stepCount<headlessSteps){
+            long before = stepCount;
+            if(field_block>1) stepBlocked(headlessSteps);
+            else step();
+            agentSum += (double)agents.size()*(stepCount-before);
+            captureFrame();
+        }
+        std::chrono::duration<double> el = std::chrono::high_resolution_clock::now()-t0;
+        cout<<stepCount<<" steps in "<<el.count()<<" s\n";
+        if(!framePattern.empty()){
+            long n=framesQueued;
+            cout<<n<<" frames of "<<frameW<<"x"<<frameH<<" ("<<frameEncoders<<" encoders): "
+                <<(n ? 1e3*frameRenderSeconds/n : 0)<<" ms/frame rendering, "
+                <<frameWaitSeconds<<" s waiting for encoders\n";
+            if(!finishFrames()) return 1;
+            if(!framePng)
+                cout<<"ffmpeg -f rawvideo -pix_fmt rgb24 -s "<<frameW<<"x"<<frameH<<" -i "<<framePattern<<" out.mp4\n";
+        }
+        if(step_threads>0 && schedWall>0){
+            double lo=1, hi=0, sum=0;
+            for(auto &st:threadStats){
+                double u=st.busy/schedWall;
+                lo=min(lo,u); hi=max(hi,u); sum+=u;
+            }
+            cout<<step_threads<<" threads, utilization "<<100*lo<<"% min, "<<100*sum/step_threads
+                <<"% mean, "<<100*hi<<"% max of "<<schedWall<<" s in parallel phases\n";
+            for(int t=0;t<step_threads;t++)
+                cout<<"  thread "<<t<<": "<<100*threadStats[t].busy/schedWall<<"% busy, "
+                    <<threadStats[t].tasks<<" tasks, "<<threadStats[t].stolen<<" stolen\n";
+        }
+        if(adaptive && stepCount>0)
+            cout<<"agents: "<<agents.size()<<" at the end, "<<(long)(agentSum/stepCount)
+                <<" on average, network "<<netCells<<" cells\n";
+        if(stepCount>0){
+            double cells = (double)GRID_W*GRID_H*stepCount;
+            cout<<"agents: "<<1e3*agentSeconds/stepCount<<" ms/step, field: "
+                <<1e3*fieldSeconds/stepCount<<" ms/step ("<<cells/fieldSeconds/1e6
+                <<" Mcells/s, "<<sizeof(trail_t)<<"-byte trail)\n";
+        }
+        if(allocMode!=ALLOC_DEFAULT) cout<<"huge pages: "<<hugePagesKB()/1024<<" MB\n";
+        if(!converged) cout<<"Network not converged after "<<stepCount-convStart<<" steps\n";
+        if(dumpFile) dumpTrail(dumpFile);
+        return 0;
+    }
+
     glutInit(&argc,argv);
     glutInitDisplayMode(GLUT_DOUBLE|GLUT_RGB);
     glutInitWindowSize(WIN_W,WIN_H);
@@ -288,10 +3914,20 @@ int main(int argc,char**argv){
 
     glutMouseFunc(mouse);
     glutMotionFunc(motion);
+    glutKeyboardFunc(keyboard);
+    glutSpecialFunc(special);
+    glutReshapeFunc(reshape);
 
     initAgents();
+    initLod();
     assignPoints();
+    applyDueEvents();
+    if(warm) warmStart();
+    setFastTrig(fastTrig);
+    viewCX = GRID_W/2.0f;
+    viewCY = GRID_H/2.0f;
     glutDisplayFunc(display);
     glutMainLoop();
     return 0;
 }
+#endif
@@ -0,0 +1,83 @@
+import socket
+import sys
+
+# ===============================
+# Ask a running `adrp --serve <socket>` for a network
+# ===============================
+# Usage: python adrp_client.py socket map.png out [options]
+#
+#   --point x y [w]    demand point, repeatable (default: random points)
+#   --seed n           --steps n           --all-steps
+#   --set name value   engine parameter, e.g. --set evaporation 0.03
+#   --network          write the network mask instead of the trail
+#   --no-terrain       --fast-trig         --sync      --warm-start
+#
+# The map bytes are sent with the request, so the server needs no access
+# to the client's files. `out` gets the server's result as is: a trail
+# dump (readable by trail_compare.py) or "NETWORK w h" and a byte per cell.
+
+
+def request(argv):
+    lines = []
+    i = 0
+    while i < len(argv):
+        a = argv[i]
+        if a == '--point':
+            args = argv[i + 1:i + 4]
+            if len(args) < 3 or args[2].startswith('--'):
+                args = args[:2]
+            lines.append('point ' + ' '.join(args))
+            i += len(args)
+        elif a in ('--seed', '--steps'):
+            lines.append(a[2:] + ' ' + argv[i + 1])
+            i += 1
+        elif a == '--set':
+            lines.append('set %s %s' % (argv[i + 1], argv[i + 2]))
+            i += 2
+        elif a == '--all-steps':
+            lines.append('until steps')
+        elif a == '--network':
+            lines.append('output network')
+        elif a in ('--no-terrain', '--fast-trig', '--sync', '--warm-start'):
+            lines.append(a[2:])
+        else:
+            sys.exit('unknown option ' + a)
+        i += 1
+    return lines
+
+
+def main():
+    if len(sys.argv) < 4:
+        sys.exit('usage: adrp_client.py socket map out [options]')
+    path, map_file, out_file = sys.argv[1:4]
+    with open(map_file, 'rb') as f:
+        data = f.read()
+
+    s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    s.connect(path)
+    head = '\n'.join(request(sys.argv[4:]))
+    s.sendall(('map-data %d\n' % len(data)).encode() + data +
+              ('\n' + head + '\nrun\n').encode())
+
+    reply = s.makefile('rb')
+    while True:
+        line = reply.readline()
+        if not line:
+            sys.exit('server closed the connection')
+        word = line.split()[0]
+        if word == b'error':
+            sys.exit(line.decode().strip())
+        if word in (b'TRAIL', b'NETWORK'):
+            break
+        print(line.decode().strip())
+
+    w, h = int(line.split()[1]), int(line.split()[2])
+    size = w * h * (4 if word == b'TRAIL' else 1)
+    body = reply.read(size)
+    if len(body) != size:
+        sys.exit('short result')
+    with open(out_file, 'wb') as f:
+        f.write(line + body)
+
+
+main()
@@ -2,6 +2,7 @@
 #include <cuda.h>
 #include <cuda_runtime.h>
 #include <curand_kernel.h>
+#include <cuda_fp16.h>
 #include <chrono>
 #include <vector>
 #include <cmath>
@@ -39,17 +40,54 @@ float diffusion_rate  = 0.1f;
 int GRID_W = 0;
 int GRID_H = 0;
 
+/* Maze byte: 0 = free road at full speed, 1..254 = slower roads,
+   WALL = impassable. One byte gives both the wall test and the cost. */
+#define WALL 255
+
+float terrain_min_speed    = 0.25f;
+float terrain_deposit_gain = 1.0f;
+
+/* ---------------- Trail Storage ---------------- */
+
+/* -DTRAIL_HALF stores the trail as half floats: half the bytes for the
+   diffusion/evaporation sweeps and for the per-frame copy to the host.
+   Deposits use the native half atomicAdd (sm_70 and newer). */
+#ifdef TRAIL_HALF
+typedef __half trail_t;
+#else
+typedef float trail_t;
+#endif
+
+__host__ __device__ __forceinline__
+float tload(trail_t v){
+#ifdef TRAIL_HALF
+    return __half2float(v);
+#else
+    return v;
+#endif
+}
+
+__host__ __device__ __forceinline__
+trail_t tstore(float v){
+#ifdef TRAIL_HALF
+    return __float2half(fminf(v, 65504.0f));
+#else
+    return v;
+#endif
+}
+
 /* ---------------- GPU Buffers ---------------- */
 
 float *d_ax, *d_ay, *d_angle;
-float *d_trail, *d_trail_tmp;
-int   *d_maze;
+trail_t *d_trail, *d_trail_tmp;
+unsigned char *d_maze;
+float *d_terrain;   /* 256 speed scales followed by 256 deposit scales */
 curandState *d_rng;
 
 /* ---------------- Host Buffers ---------------- */
 
-vector<int>   h_maze;
-vector<float> h_trail;
+vector<unsigned char> h_maze;
+vector<trail_t> h_trail;
 
 /* ---------------- Utilities ---------------- */
 
@@ -70,7 +108,7 @@ __global__ void initRNG(curandState* rng, unsigned seed){
 
 __global__ void updateAgentsKernel(
     float* ax, float* ay, float* angle,
-    float* trail, int* maze,
+    trail_t* trail, unsigned char* maze, const float* terrain,
     curandState* rng,
     int W, int H,
     float sensor_distance,
@@ -79,6 +117,15 @@ __global__ void updateAgentsKernel(
     float step_size,
     float deposit_amount
 ){
+    /* terrain tables live in shared memory: agents in a warp hit random
+       entries, which constant memory would serialize */
+    __shared__ float speedLUT[256], depositLUT[256];
+    for (int k = threadIdx.x; k < 256; k += blockDim.x) {
+        speedLUT[k]   = terrain[k];
+        depositLUT[k] = terrain[256 + k];
+    }
+    __syncthreads();
+
     int i = blockIdx.x * blockDim.x + threadIdx.x;
     if (i >= NUM_AGENTS) return;
 
@@ -92,8 +139,8 @@ __global__ void updateAgentsKernel(
         int xi = (int)sx;
         int yi = (int)sy;
         if (xi < 0 || xi >= W || yi < 0 || yi >= H) return 0.0f;
-        if (maze[idx(xi, yi, W)]) return 0.0f;
-        return trail[idx(xi, yi, W)];
+        if (maze[idx(xi, yi, W)] == WALL) return 0.0f;
+        return tload(trail[idx(xi, yi, W)]);
     };
 
     float f = sample(x + cosf(a) * sensor_distance,
@@ -114,13 +161,16 @@ __global__ void updateAgentsKernel(
     float nx = x + cosf(a) * step_size;
     float ny = y + sinf(a) * step_size;
 
-    int xi = (int)nx;
-    int yi = (int)ny;
+    /* one maze lookup gives both the wall test and the terrain speed */
+    float sp = 0.0f;
+    if (nx >= 0 && nx < W && ny >= 0 && ny < H)
+        sp = speedLUT[maze[idx((int)nx, (int)ny, W)]];
 
-    if (xi >= 0 && xi < W && yi >= 0 && yi < H && !maze[idx(xi, yi, W)]) {
-        x = nx;
-        y = ny;
-        atomicAdd(&trail[idx(xi, yi, W)], deposit_amount);
+    if (sp > 0.0f) {
+        x += (nx - x) * sp;
+        y += (ny - y) * sp;
+        int id = idx((int)x, (int)y, W);
+        atomicAdd(&trail[id], tstore(deposit_amount * depositLUT[maze[id]]));
     } else {
         a += 3.1415926f * (curand_uniform(&local) - 0.5f);
     }
@@ -134,15 +184,15 @@ __global__ void updateAgentsKernel(
 /* ---------------- Diffusion ---------------- */
 
 __global__ void diffuseKernel(
-    float* trail, float* out,
-    int* maze, int W, int H,
+    trail_t* trail, trail_t* out,
+    unsigned char* maze, int W, int H,
     float diffusion_rate
 ){
     int x = blockIdx.x * blockDim.x + threadIdx.x;
     int y = blockIdx.y * blockDim.y + threadIdx.y;
 
     if (x <= 0 || x >= W - 1 || y <= 0 || y >= H - 1) return;
-    if (maze[idx(x, y, W)]) return;
+    if (maze[idx(x, y, W)] == WALL) return;
 
     float sum = 0.0f;
     int count = 0;
@@ -150,31 +200,32 @@ __global__ void diffuseKernel(
     for (int dy = -1; dy <= 1; dy++)
         for (int dx = -1; dx <= 1; dx++) {
             int id = idx(x + dx, y + dy, W);
-            if (!maze[id]) {
-                sum += trail[id];
+            if (maze[id] != WALL) {
+                sum += tload(trail[id]);
                 count++;
             }
         }
 
     int id = idx(x, y, W);
-    out[id] = trail[id] * (1.0f - diffusion_rate)
-            + (sum / count) * diffusion_rate;
+    out[id] = tstore(tload(trail[id]) * (1.0f - diffusion_rate)
+                   + (sum / count) * diffusion_rate);
 }
 
 /* ---------------- Evaporation ---------------- */
 
 __global__ void evaporateKernel(
-    float* trail,
+    trail_t* trail,
     int n,
     float evaporation
 ){
     int i = blockIdx.x * blockDim.x + threadIdx.x;
     if (i < n)
-        trail[i] *= (1.0f - evaporation);
+        trail[i] = tstore(tload(trail[i]) * (1.0f - evaporation));
 }
 
 /* ---------------- Map Loader ---------------- */
 
+/* grey <= 128 is a wall; brighter grey is a road whose cost falls to 0 at white */
 void loadMap(const char* filename){
     int w, h, n;
     unsigned char* img = stbi_load(filename, &w, &h, &n, 1);
@@ -190,8 +241,10 @@ void loadMap(const char* filename){
     h_maze.resize(w * h);
 
     for (int y = 0; y < h; y++)
-        for (int x = 0; x < w; x++)
-            h_maze[y * w + x] = img[y * w + x] > 128 ? 0 : 1;
+        for (int x = 0; x < w; x++) {
+            int v = img[y * w + x];
+            h_maze[y * w + x] = v > 128 ? (unsigned char)min((255 - v) * 254 / 126, 254) : WALL;
+        }
 
     stbi_image_free(img);
 }
@@ -206,12 +259,21 @@ void initGPU(){
     cudaMalloc(&d_angle, NUM_AGENTS * sizeof(float));
     cudaMalloc(&d_rng, NUM_AGENTS * sizeof(curandState));
 
-    cudaMalloc(&d_trail,     N * sizeof(float));
-    cudaMalloc(&d_trail_tmp, N * sizeof(float));
-    cudaMalloc(&d_maze,      N * sizeof(int));
+    cudaMalloc(&d_trail,     N * sizeof(trail_t));
+    cudaMalloc(&d_trail_tmp, N * sizeof(trail_t));
+    cudaMalloc(&d_maze,      N * sizeof(unsigned char));
+    cudaMalloc(&d_terrain,   512 * sizeof(float));
 
-    cudaMemcpy(d_maze, h_maze.data(), N * sizeof(int), cudaMemcpyHostToDevice);
-    cudaMemset(d_trail, 0, N * sizeof(float));
+    cudaMemcpy(d_maze, h_maze.data(), N * sizeof(unsigned char), cudaMemcpyHostToDevice);
+
+    float terrain[512];
+    for (int c = 0; c < 256; c++) {
+        float s = 1.0f - (1.0f - terrain_min_speed) * c / 254.0f;
+        terrain[c]       = (c == WALL) ? 0.0f : s;
+        terrain[256 + c] = (c == WALL) ? 0.0f : 1.0f - terrain_deposit_gain * (1.0f - s);
+    }
+    cudaMemcpy(d_terrain, terrain, 512 * sizeof(float), cudaMemcpyHostToDevice);
+    cudaMemset(d_trail, 0, N * sizeof(trail_t));
 
     vector<float> ax(NUM_AGENTS), ay(NUM_AGENTS), an(NUM_AGENTS);
 
@@ -221,7 +283,7 @@ void initGPU(){
         do {
             x = rand() % GRID_W;
             y = rand() % GRID_H;
-        } while (h_maze[y * GRID_W + x]);
+        } while (h_maze[y * GRID_W + x] == WALL);
 
         ax[i] = (float)x;
         ay[i] = (float)y;
@@ -242,7 +304,7 @@ void display(){
 
     updateAgentsKernel<<<(NUM_AGENTS + 255) / 256, 256>>>(
         d_ax, d_ay, d_angle,
-        d_trail, d_maze, d_rng,
+        d_trail, d_maze, d_terrain, d_rng,
         GRID_W, GRID_H,
         sensor_distance,
         sensor_angle,
@@ -270,16 +332,16 @@ void display(){
 
     h_trail.resize(GRID_W * GRID_H);
     cudaMemcpy(h_trail.data(), d_trail,
-               GRID_W * GRID_H * sizeof(float),
+               GRID_W * GRID_H * sizeof(trail_t),
                cudaMemcpyDeviceToHost);
 
     float maxv = 1e-6f;
-    for (float v : h_trail) maxv = max(maxv, v);
+    for (trail_t v : h_trail) maxv = max(maxv, tload(v));
 
     glBegin(GL_POINTS);
     for (int y = 0; y < GRID_H; y++)
         for (int x = 0; x < GRID_W; x++) {
-            float v = h_trail[y * GRID_W + x] / maxv;
+            float v = tload(h_trail[y * GRID_W + x]) / maxv;
             if (v > 0.01f) {
                 glColor3f(v, v, v);
                 glVertex2f(
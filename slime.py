@@ -0,0 +1,166 @@
+import ctypes
+import os
+import sys
+
+import numpy as np
+
+# ===============================
+# Python bindings for the adrp.cpp engine
+# ===============================
+# Build the library next to this file first:
+#
+#   g++ -O3 -march=native -shared -fPIC -DADRP_LIB adrp.cpp -o libadrp.so
+#   g++ -O3 -march=native -shared -DADRP_LIB adrp.cpp -o adrp.dll      (Windows)
+#
+# or point ADRP_LIB at it. Example:
+#
+#   from slime import Engine
+#   e = Engine('map.png', seed=1)
+#   e.step(2000)                  # runs without holding the GIL
+#   t = e.trail                   # numpy view of the engine's trail, no copy
+#   net = t > 2 * t[e.maze != 255].mean()
+#
+# trail, maze, agents and points are views over the engine's memory. They
+# are only valid until the next step() or point edit, which may move the
+# buffers, so take them again after each call (or .copy() to keep one).
+# The engine's state is global in the library, so a process has one
+# Engine at a time; sweep in several processes.
+
+WALL = 255
+
+AGENT = np.dtype([('x', '<f4'), ('y', '<f4'), ('angle', '<f4'),
+                  ('dx', '<f4'), ('dy', '<f4'), ('id', '<u4')])
+POINT = np.dtype([('x', '<f4'), ('y', '<f4'), ('weight', '<f4'), ('id', '<i4')])
+
+
+def _load():
+    here = os.path.dirname(os.path.abspath(__file__))
+    name = 'adrp.dll' if sys.platform == 'win32' else 'libadrp.so'
+    lib = ctypes.CDLL(os.environ.get('ADRP_LIB', os.path.join(here, name)))
+    c_long_p = ctypes.POINTER(ctypes.c_long)
+    for fn, res, args in [
+        ('adrp_load_map', ctypes.c_int, [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int]),
+        ('adrp_reset', None, [ctypes.c_uint, ctypes.c_int]),
+        ('adrp_step', ctypes.c_long, [ctypes.c_long, ctypes.c_int]),
+        ('adrp_set', ctypes.c_int, [ctypes.c_char_p, ctypes.c_float]),
+        ('adrp_add_point', ctypes.c_int, [ctypes.c_float] * 3),
+        ('adrp_move_point', ctypes.c_int, [ctypes.c_int, ctypes.c_float, ctypes.c_float]),
+        ('adrp_remove_point', ctypes.c_int, [ctypes.c_int]),
+        ('adrp_weight_point', ctypes.c_int, [ctypes.c_int, ctypes.c_float]),
+        ('adrp_warm_start', None, []),
+        ('adrp_width', ctypes.c_int, []),
+        ('adrp_height', ctypes.c_int, []),
+        ('adrp_step_count', ctypes.c_long, []),
+        ('adrp_converged', ctypes.c_int, []),
+        ('adrp_agent_size', ctypes.c_int, []),
+        ('adrp_point_size', ctypes.c_int, []),
+        ('adrp_trail_scale', ctypes.c_int, []),
+        ('adrp_trail', ctypes.c_void_p, []),
+        ('adrp_maze', ctypes.c_void_p, []),
+        ('adrp_agents', ctypes.c_void_p, [c_long_p]),
+        ('adrp_points', ctypes.c_void_p, [c_long_p]),
+    ]:
+        f = getattr(lib, fn)
+        f.restype = res
+        f.argtypes = args
+    # a CDLL call releases the GIL, so step() lets other threads run
+    if lib.adrp_agent_size() != AGENT.itemsize or lib.adrp_point_size() != POINT.itemsize:
+        sys.exit('slime.py: agent/point layout does not match the library')
+    return lib
+
+
+_lib = None
+_live = None
+
+
+def _view(ptr, dtype, shape, writeable=True):
+    n = int(np.prod(shape))
+    if not ptr or n == 0:
+        return np.zeros(shape, dtype)
+    buf = (ctypes.c_char * (n * dtype.itemsize)).from_address(ptr)
+    a = np.frombuffer(buf, dtype).reshape(shape)
+    a.flags.writeable = writeable
+    return a
+
+
+class Engine:
+    def __init__(self, map_file='map.png', terrain=None, use_terrain=True,
+                 seed=1, random_points=True):
+        global _lib, _live
+        if _live is not None:
+            raise RuntimeError('one Engine per process; close() the other first')
+        if _lib is None:
+            _lib = _load()
+        if not _lib.adrp_load_map(map_file.encode(),
+                                  terrain.encode() if terrain else None, use_terrain):
+            raise IOError('cannot load map ' + map_file)
+        _live = self
+        self.width = _lib.adrp_width()
+        self.height = _lib.adrp_height()
+        scale = _lib.adrp_trail_scale()
+        self._trail_type = np.dtype('<u2') if scale else np.dtype('<f4')
+        self.trail_scale = scale or 1   # trail value = cell / trail_scale
+        self.reset(seed, random_points)
+
+    def close(self):
+        global _live
+        if _live is self:
+            _live = None
+
+    def reset(self, seed=1, random_points=True):
+        _lib.adrp_reset(seed, random_points)
+
+    def step(self, n=1, until_converged=False):
+        """Run n steps (fewer if until_converged); returns the steps run."""
+        return _lib.adrp_step(n, until_converged)
+
+    def set(self, name, value):
+        """Engine parameter by name, as `set` in the server protocol."""
+        if not _lib.adrp_set(name.encode(), value):
+            raise KeyError(name)
+
+    def add_point(self, x, y, weight=1.0):
+        pid = _lib.adrp_add_point(x, y, weight)
+        if pid < 0:
+            raise ValueError('no free cell near (%g, %g)' % (x, y))
+        return pid
+
+    def move_point(self, pid, x, y):
+        return bool(_lib.adrp_move_point(pid, x, y))
+
+    def remove_point(self, pid):
+        return bool(_lib.adrp_remove_point(pid))
+
+    def weight_point(self, pid, weight):
+        return bool(_lib.adrp_weight_point(pid, weight))
+
+    def warm_start(self):
+        """Seed trail and agents from the current points (--warm-start)."""
+        _lib.adrp_warm_start()
+
+    @property
+    def steps(self):
+        return _lib.adrp_step_count()
+
+    @property
+    def converged(self):
+        return bool(_lib.adrp_converged())
+
+    @property
+    def trail(self):
+        return _view(_lib.adrp_trail(), self._trail_type, (self.height, self.width))
+
+    @property
+    def maze(self):
+        # read-only: walls drawn behind the engine's back would skip its bookkeeping
+        return _view(_lib.adrp_maze(), np.dtype('u1'), (self.height, self.width), False)
+
+    @property
+    def agents(self):
+        n = ctypes.c_long()
+        return _view(_lib.adrp_agents(ctypes.byref(n)), AGENT, (n.value,))
+
+    @property
+    def points(self):
+        n = ctypes.c_long()
+        return _view(_lib.adrp_points(ctypes.byref(n)), POINT, (n.value,), False)
@@ -0,0 +1,74 @@
+import math
+import sys
+from array import array
+
+# ===============================
+# Compare two trail dumps written by `adrp --dump-trail`
+# ===============================
+# Usage: python trail_compare.py reference.trl other.trl
+#
+# Two runs only match cell for cell when they take the same path, so
+# besides the raw error this reports how well the extracted networks
+# agree. Compare against two fp32 runs with different seeds to see what
+# level of disagreement is just run-to-run noise.
+
+NETWORK_FACTOR = 2.0   # conv_threshold in adrp.cpp
+
+
+def load(path):
+    with open(path, 'rb') as f:
+        header = f.readline().split()
+        if len(header) != 3 or header[0] != b'TRAIL':
+            sys.exit(path + ': not a trail dump')
+        w, h = int(header[1]), int(header[2])
+        values = array('f')
+        values.frombytes(f.read(w * h * 4))
+    if sys.byteorder != 'little':
+        values.byteswap()
+    return w, h, values
+
+
+# adrp.cpp thresholds the mean over free cells. The dump has no maze, so
+# the free cells are taken as those with trail in either dump (walls are
+# always 0). Using the same cells for both dumps keeps a 16-bit trail, which
+# rounds faint cells to 0, from getting a higher threshold than its fp32
+# reference. Free cells no trail ever reached still count as walls here.
+def network(values, free):
+    mean = sum(values[i] for i in free) / max(len(free), 1)
+    return [v > NETWORK_FACTOR * mean for v in values]
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: trail_compare.py reference.trl other.trl')
+    w, h, a = load(sys.argv[1])
+    w2, h2, b = load(sys.argv[2])
+    if (w, h) != (w2, h2):
+        sys.exit('grid sizes differ: %dx%d vs %dx%d' % (w, h, w2, h2))
+
+    n = len(a)
+    max_a = max(a) or 1.0
+    max_abs = max(abs(x - y) for x, y in zip(a, b))
+    rmse = math.sqrt(sum((x - y) ** 2 for x, y in zip(a, b)) / n)
+
+    mean_a, mean_b = sum(a) / n, sum(b) / n
+    cov = sum((x - mean_a) * (y - mean_b) for x, y in zip(a, b))
+    var_a = sum((x - mean_a) ** 2 for x in a)
+    var_b = sum((y - mean_b) ** 2 for y in b)
+    corr = cov / math.sqrt(var_a * var_b) if var_a and var_b else 1.0
+
+    free = [i for i in range(n) if a[i] > 0 or b[i] > 0]
+    net_a, net_b = network(a, free), network(b, free)
+    inter = sum(1 for x, y in zip(net_a, net_b) if x and y)
+    union = sum(1 for x, y in zip(net_a, net_b) if x or y)
+
+    print('grid            : %dx%d' % (w, h))
+    print('max |diff|      : %.4g (%.3f%% of max)' % (max_abs, 100 * max_abs / max_a))
+    print('rmse            : %.4g (%.3f%% of max)' % (rmse, 100 * rmse / max_a))
+    print('total trail     : %.6g vs %.6g' % (sum(a), sum(b)))
+    print('correlation     : %.4f' % corr)
+    print('network cells   : %d vs %d' % (sum(net_a), sum(net_b)))
+    print('network overlap : %.3f (Jaccard)' % (inter / union if union else 1.0))
+
+
+main()